@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#include "hackernel/ipc.h"
+#include "hackernel/report.h"
+#include "hackernel/util.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <thread>
+
+static std::atomic<uint64_t> allocations = 0;
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept {
+    free(ptr);
+}
+
+using namespace hackernel;
+
+bool current_service_status() {
+    return true;
+}
+
+void shutdown_service(int status_code) {}
+
+static std::atomic<uint64_t> handled = 0;
+
+// 与 IPC 的订阅推送相同,消费者取出消息后读取 payload
+static bool handle_msg(const message_ptr &msg) {
+    handled.fetch_add(msg->payload().empty() ? 0 : 1, std::memory_order_release);
+    return true;
+}
+
+// 统计从产生事件到消费者处理完成的全部内存分配
+static void measure(const char *name, std::function<message_ptr()> generate, int rounds) {
+    uint64_t expected = handled.load() + rounds;
+    uint64_t before = allocations.load();
+    for (int i = 0; i < rounds; ++i)
+        broadcaster::global().broadcast(generate());
+    while (handled.load(std::memory_order_acquire) < expected)
+        std::this_thread::yield();
+    uint64_t after = allocations.load();
+    printf("%-16s %6.2f allocations/event\n", name, (double)(after - before) / rounds);
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 100000;
+
+    auto audience = std::make_shared<hackernel::audience>("bench");
+    audience->add_message_handler(handle_msg);
+    broadcaster::global().add_audience(audience, {"kernel::", "user::"});
+    std::thread consumer([&] { audience->start_consuming_message(); });
+
+    measure(
+        "file::report", [] { return make_file_report_msg("/root/.ssh/authorized_keys", 1, 2049UL, 1835017UL); },
+        rounds);
+    measure(
+        "net::report", [] { return make_net_report_msg(6, 0xC0A80101, 0x0A000002, 51234, 22, 1); }, rounds);
+    measure(
+        "proc::report",
+        [] { return make_process_report_msg("/home/user", "/usr/bin/curl", "curl\u001f-s\u001fhttps://example.com/"); },
+        rounds);
+    measure(
+        "user::test::echo",
+        [] { return message::make(1, "user::test::echo", "{\"extra\":null,\"type\":\"user::test::echo\"}"); },
+        rounds);
+
+    audience->stop_consuming_message();
+    consumer.join();
+    return 0;
+}
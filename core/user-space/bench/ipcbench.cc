@@ -0,0 +1,331 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <nlohmann/json.hpp>
+#include <poll.h>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// 对运行中的服务端施加负载,统计往返延迟和吞吐量.
+// 每个并发连接是一个独立的数据报 socket 和线程,按回复中的 extra 匹配请求.
+// 文件和网络请求使用不产生实际防护效果的参数,可以在正常运行的机器上执行
+
+typedef std::chrono::steady_clock steady;
+
+enum op_type { OP_ECHO, OP_SUB, OP_FILE, OP_NET, OP_MAX };
+static const char *OP_NAMES[OP_MAX] = {"echo", "sub", "file", "net"};
+
+struct options {
+    int concurrency = 4;
+    // 每秒发送的请求总数,为 0 时每个连接在窗口允许的范围内尽快发送
+    double rate = 0;
+    int duration = 10;
+    // 每个连接最多未响应的请求数
+    int window = 32;
+    int timeout = 1000;
+    int weights[OP_MAX] = {100, 0, 0, 0};
+    std::string path = "/tmp/hackernel.sock";
+};
+
+struct slot {
+    uint64_t id = 0;
+    op_type op = OP_ECHO;
+    steady::time_point start;
+    bool used = false;
+};
+
+struct result {
+    std::vector<uint64_t> latencies[OP_MAX];
+    uint64_t sent[OP_MAX] = {};
+    uint64_t lost[OP_MAX] = {};
+};
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-c concurrency] [-r rate] [-d seconds] [-w window] [-t timeout_ms] [-m mix] [-s socket]\n"
+            "  mix: weights of echo, sub, file and net, e.g. echo:70,sub:10,file:10,net:10\n",
+            name);
+}
+
+static int parse_mix(const char *text, int weights[OP_MAX]) {
+    std::fill(weights, weights + OP_MAX, 0);
+    std::string mix = text;
+    size_t begin = 0;
+    while (begin < mix.size()) {
+        size_t end = mix.find(',', begin);
+        if (end == std::string::npos)
+            end = mix.size();
+        std::string item = mix.substr(begin, end - begin);
+        size_t colon = item.find(':');
+        if (colon == std::string::npos)
+            return -EINVAL;
+
+        std::string name = item.substr(0, colon);
+        auto it = std::find_if(OP_NAMES, OP_NAMES + OP_MAX, [&](const char *op) { return name == op; });
+        if (it == OP_NAMES + OP_MAX)
+            return -EINVAL;
+        weights[it - OP_NAMES] = atoi(item.c_str() + colon + 1);
+        begin = end + 1;
+    }
+    return std::any_of(weights, weights + OP_MAX, [](int weight) { return weight > 0; }) ? 0 : -EINVAL;
+}
+
+static int parse_options(int argc, char *argv[], options &opts) {
+    int opt;
+    while ((opt = getopt(argc, argv, "c:r:d:w:t:m:s:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            opts.concurrency = atoi(optarg);
+            break;
+        case 'r':
+            opts.rate = atof(optarg);
+            break;
+        case 'd':
+            opts.duration = atoi(optarg);
+            break;
+        case 'w':
+            opts.window = atoi(optarg);
+            break;
+        case 't':
+            opts.timeout = atoi(optarg);
+            break;
+        case 'm':
+            if (parse_mix(optarg, opts.weights))
+                return -EINVAL;
+            break;
+        case 's':
+            opts.path = optarg;
+            break;
+        default:
+            return -EINVAL;
+        }
+    }
+    if (opts.concurrency <= 0 || opts.duration <= 0 || opts.window <= 0 || opts.timeout <= 0 || opts.rate < 0)
+        return -EINVAL;
+    if (opts.path.size() >= sizeof(sockaddr_un::sun_path))
+        return -EINVAL;
+    return 0;
+}
+
+// 绑定到自动分配的抽象地址,并连接到服务端,之后只收到服务端的回复
+static int connect_server(const std::string &path) {
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd == -1)
+        return -1;
+
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(sa_family_t)))
+        goto errout;
+
+    strncpy(addr.sun_path, path.data(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+        goto errout;
+    return fd;
+
+errout:
+    close(fd);
+    return -1;
+}
+
+// 订阅和网络策略交替发送成对的请求,不在服务端留下状态.
+// 网络策略只匹配 0.0.0.0 之间的流量,文件请求移除一个不存在的路径的防护
+static std::string make_request(op_type op, int worker, uint64_t id, bool &toggle) {
+    nlohmann::json request;
+    switch (op) {
+    case OP_ECHO:
+        request["type"] = "user::test::echo";
+        break;
+    case OP_SUB:
+        request["type"] = toggle ? "user::msg::unsub" : "user::msg::sub";
+        request["section"] = "bench::ipc::" + std::to_string(worker);
+        toggle = !toggle;
+        break;
+    case OP_FILE:
+        request["type"] = "user::file::set";
+        request["path"] = "/tmp/hackernel-bench/" + std::to_string(worker) + "/" + std::to_string(id);
+        request["perm"] = 0;
+        request["flag"] = 0;
+        break;
+    case OP_NET:
+        if (toggle) {
+            request["type"] = "user::net::delete";
+            request["id"] = 0x40000000 + worker;
+        } else {
+            request["type"] = "user::net::insert";
+            request["id"] = 0x40000000 + worker;
+            request["priority"] = 0;
+            request["addr"] = {{"src", {{"begin", "0.0.0.0"}, {"end", "0.0.0.0"}}},
+                               {"dst", {{"begin", "0.0.0.0"}, {"end", "0.0.0.0"}}}};
+            request["protocol"] = {{"begin", 0}, {"end", 255}};
+            request["port"] = {{"src", {{"begin", 0}, {"end", 65535}}}, {"dst", {{"begin", 0}, {"end", 65535}}}};
+            request["flags"] = 1;
+            request["response"] = 1;
+        }
+        toggle = !toggle;
+        break;
+    default:
+        break;
+    }
+    request["extra"] = id;
+    return request.dump();
+}
+
+// 限速时按计划的发送时间计算延迟,服务端变慢导致的发送推迟同样计入延迟
+static void run_worker(const options &opts, int worker, steady::time_point begin, result &res) {
+    int fd = connect_server(opts.path);
+    if (fd == -1) {
+        fprintf(stderr, "connect %s failed, errno=%d\n", opts.path.data(), errno);
+        return;
+    }
+
+    std::mt19937 random(worker);
+    std::discrete_distribution<int> pick(opts.weights, opts.weights + OP_MAX);
+    std::vector<slot> slots(opts.window);
+    std::vector<size_t> free_slots;
+    for (size_t i = 0; i < slots.size(); ++i)
+        free_slots.push_back(slots.size() - 1 - i);
+
+    auto interval = std::chrono::duration_cast<steady::duration>(
+        std::chrono::duration<double>(opts.rate > 0 ? opts.concurrency / opts.rate : 0));
+    auto timeout = std::chrono::milliseconds(opts.timeout);
+    steady::time_point end = begin + std::chrono::seconds(opts.duration);
+    steady::time_point next = begin;
+    bool toggles[OP_MAX] = {};
+    bool blocked = false;
+    uint64_t seq = 0;
+    char buffer[65536];
+
+    for (;;) {
+        steady::time_point now = steady::now();
+        if (now >= end && free_slots.size() == slots.size())
+            break;
+        if (now >= end + timeout)
+            break;
+
+        while (!blocked && now < end && !free_slots.empty() && now >= next) {
+            size_t index = free_slots.back();
+            op_type op = (op_type)pick(random);
+            uint64_t id = ++seq * slots.size() + index;
+            std::string request = make_request(op, worker, id, toggles[op]);
+            if (send(fd, request.data(), request.size(), 0) == -1) {
+                if (errno == EAGAIN) {
+                    blocked = true;
+                    break;
+                }
+                ++res.sent[op];
+                ++res.lost[op];
+                break;
+            }
+            free_slots.pop_back();
+            slots[index] = {id, op, opts.rate > 0 ? next : now, true};
+            ++res.sent[op];
+            next = opts.rate > 0 ? next + interval : now;
+        }
+
+        for (size_t i = 0; i < slots.size(); ++i) {
+            if (slots[i].used && now - slots[i].start > timeout) {
+                ++res.lost[slots[i].op];
+                slots[i].used = false;
+                free_slots.push_back(i);
+            }
+        }
+
+        int wait = 1;
+        if (opts.rate > 0 && !free_slots.empty() && next > now)
+            wait = std::max<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count(), 0);
+        struct pollfd pfd = {.fd = fd, .events = (short)(POLLIN | (blocked ? POLLOUT : 0)), .revents = 0};
+        if (poll(&pfd, 1, wait) <= 0)
+            continue;
+        if (pfd.revents & POLLOUT)
+            blocked = false;
+
+        ssize_t size;
+        while ((size = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            steady::time_point received = steady::now();
+            nlohmann::json reply = nlohmann::json::parse(buffer, buffer + size, nullptr, false);
+            if (reply.is_discarded() || !reply["extra"].is_number_unsigned())
+                continue;
+
+            uint64_t id = reply["extra"];
+            slot &current = slots[id % slots.size()];
+            if (!current.used || current.id != id)
+                continue;
+            res.latencies[current.op].push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(received - current.start).count());
+            current.used = false;
+            free_slots.push_back(id % slots.size());
+        }
+    }
+
+    for (const slot &current : slots)
+        if (current.used)
+            ++res.lost[current.op];
+    close(fd);
+}
+
+static double percentile(const std::vector<uint64_t> &sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    size_t index = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+    return sorted[index] / 1000.0;
+}
+
+static void report(const char *name, std::vector<uint64_t> &latencies, uint64_t sent, uint64_t lost) {
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-6s %10lu %10zu %8lu %10.1f %10.1f %10.1f %10.1f\n", name, sent, latencies.size(), lost,
+           percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 0.999),
+           latencies.empty() ? 0 : latencies.back() / 1000.0);
+}
+
+int main(int argc, char *argv[]) {
+    options opts;
+    if (parse_options(argc, argv, opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<result> results(opts.concurrency);
+    std::vector<std::thread> workers;
+    steady::time_point begin = steady::now();
+    for (int i = 0; i < opts.concurrency; ++i)
+        workers.emplace_back([&, i] { run_worker(opts, i, begin, results[i]); });
+    for (auto &worker : workers)
+        worker.join();
+    double elapsed = std::chrono::duration<double>(steady::now() - begin).count();
+
+    result total;
+    std::vector<uint64_t> all;
+    for (const result &res : results) {
+        for (int op = 0; op < OP_MAX; ++op) {
+            total.latencies[op].insert(total.latencies[op].end(), res.latencies[op].begin(), res.latencies[op].end());
+            total.sent[op] += res.sent[op];
+            total.lost[op] += res.lost[op];
+        }
+    }
+
+    printf("%-6s %10s %10s %8s %10s %10s %10s %10s\n", "type", "sent", "received", "lost", "p50(us)", "p99(us)",
+           "p999(us)", "max(us)");
+    uint64_t sent = 0, lost = 0;
+    for (int op = 0; op < OP_MAX; ++op) {
+        if (!total.sent[op])
+            continue;
+        all.insert(all.end(), total.latencies[op].begin(), total.latencies[op].end());
+        sent += total.sent[op];
+        lost += total.lost[op];
+        report(OP_NAMES[op], total.latencies[op], total.sent[op], total.lost[op]);
+    }
+    report("total", all, sent, lost);
+    printf("concurrency=%d window=%d rate=%.0f elapsed=%.2fs throughput=%.0f req/s\n", opts.concurrency, opts.window,
+           opts.rate, elapsed, all.size() / elapsed);
+    return 0;
+}
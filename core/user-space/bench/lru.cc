@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#include "hackernel/lru.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace hackernel;
+
+static const size_t CAPACITY = 1024;
+
+// 与 json::parse 缓存的条目大小相当
+static nlohmann::json make_value(int key) {
+    nlohmann::json value;
+    value["type"] = "user::file::set";
+    value["path"] = "/usr/lib/x86_64-linux-gnu/libhackernel" + std::to_string(key) + ".so";
+    value["perm"] = 15;
+    value["flag"] = 1;
+    value["extra"] = {{"id", key}, {"reply_to", "collector"}};
+    return value;
+}
+
+// 九成查找一成写入,键的范围略大于容量以产生淘汰
+template <typename Cache, typename Get>
+static double measure(Cache &cache, Get get, int threads, int rounds) {
+    std::vector<std::thread> workers;
+    std::atomic<size_t> hits = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937 random(t);
+            std::uniform_int_distribution<int> keys(0, CAPACITY * 5 / 4);
+            size_t hit = 0;
+            for (int i = 0; i < rounds; ++i) {
+                int key = keys(random);
+                if (i % 10 == 0)
+                    cache.put(key, make_value(key));
+                else
+                    hit += get(cache, key);
+            }
+            hits += hit;
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / rounds;
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 200000;
+
+    for (int threads : {1, 2, 4, 8}) {
+        lru<int, nlohmann::json> plain(CAPACITY);
+        sharded_lru<int, nlohmann::json> sharded(CAPACITY);
+        for (int key = 0; key < (int)CAPACITY; ++key) {
+            plain.put(key, make_value(key));
+            sharded.put(key, make_value(key));
+        }
+
+        double before = measure(
+            plain,
+            [](lru<int, nlohmann::json> &cache, int key) {
+                nlohmann::json value;
+                return cache.get(key, value) == 0;
+            },
+            threads, rounds);
+        double after = measure(
+            sharded,
+            [](sharded_lru<int, nlohmann::json> &cache, int key) {
+                sharded_lru<int, nlohmann::json>::handle value;
+                return cache.get(key, value) == 0;
+            },
+            threads, rounds);
+        printf("threads=%d  lru %8.1f ns/op  sharded_lru %8.1f ns/op  %.2fx\n", threads, before, after,
+               before / after);
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#include "hackernel/ipc.h"
+#include "hackernel/report.h"
+#include "hackernel/util.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+using namespace hackernel;
+
+bool current_service_status() {
+    return true;
+}
+
+void shutdown_service(int status_code) {}
+
+// 改造前的做法: 构造 nlohmann::json 文档,推送订阅者时再序列化 data
+static message_ptr dom_file_report() {
+    nlohmann::json doc;
+    doc["type"] = "kernel::file::report";
+    doc["name"] = "/root/.ssh/authorized_keys";
+    doc["perm"] = 1;
+    doc["fsid"] = 2049UL;
+    doc["ino"] = 1835017UL;
+    return generate_system_broadcast_msg(doc);
+}
+
+static message_ptr dom_net_report() {
+    nlohmann::json doc;
+    struct in_addr ip_addr;
+
+    doc["type"] = "kernel::net::report";
+    doc["protocol"] = (uint8_t)6;
+    ip_addr.s_addr = htonl(0xC0A80101);
+    doc["saddr"] = inet_ntoa(ip_addr);
+    ip_addr.s_addr = htonl(0x0A000002);
+    doc["daddr"] = inet_ntoa(ip_addr);
+    doc["sport"] = (uint16_t)51234;
+    doc["dport"] = (uint16_t)22;
+    doc["policy"] = 1U;
+    return generate_system_broadcast_msg(doc);
+}
+
+static message_ptr dom_process_report() {
+    nlohmann::json doc;
+    doc["type"] = "kernel::proc::report";
+    doc["workdir"] = "/home/user";
+    doc["binary"] = "/usr/bin/curl";
+    doc["argv"] = "curl\u001f-s\u001fhttps://example.com/\"quoted\"";
+    return generate_system_broadcast_msg(doc);
+}
+
+static message_ptr writer_file_report() {
+    return make_file_report_msg("/root/.ssh/authorized_keys", 1, 2049UL, 1835017UL);
+}
+
+static message_ptr writer_net_report() {
+    return make_net_report_msg(6, 0xC0A80101, 0x0A000002, 51234, 22, 1);
+}
+
+static message_ptr writer_process_report() {
+    return make_process_report_msg("/home/user", "/usr/bin/curl", "curl\u001f-s\u001fhttps://example.com/\"quoted\"");
+}
+
+// 计时包含推送给订阅者前的 payload 序列化
+static double measure(std::function<message_ptr()> generate, int rounds) {
+    size_t total = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i)
+        total += generate()->payload().size();
+    auto end = std::chrono::steady_clock::now();
+    if (total == 0)
+        return 0;
+    return std::chrono::duration<double, std::nano>(end - begin).count() / rounds;
+}
+
+static int compare(const char *name, std::function<message_ptr()> dom, std::function<message_ptr()> writer,
+                   int rounds) {
+    message_ptr expected = dom();
+    message_ptr actual = writer();
+    if (expected->payload() != actual->payload() || expected->type() != actual->type()) {
+        printf("%s: mismatch\n  dom:    %s\n  writer: %s\n", name, expected->payload().data(),
+               actual->payload().data());
+        return -EINVAL;
+    }
+
+    double before = measure(dom, rounds);
+    double after = measure(writer, rounds);
+    printf("%-16s dom %8.1f ns/op  writer %8.1f ns/op  %.2fx\n", name, before, after, before / after);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 1000000;
+    int error = 0;
+
+    error |= compare("file::report", dom_file_report, writer_file_report, rounds);
+    error |= compare("net::report", dom_net_report, writer_net_report, rounds);
+    error |= compare("proc::report", dom_process_report, writer_process_report, rounds);
+    return error ? 1 : 0;
+}
@@ -14,20 +14,20 @@ static std::shared_ptr<audience> dispatcher = nullptr;
 int start_dispatcher() {
     update_thread_name("dispatcher");
 
-    dispatcher = std::make_shared<audience>();
-    dispatcher->add_message_handler(handle_process_protection_enable_msg);
-    dispatcher->add_message_handler(handle_process_protection_disable_msg);
-    dispatcher->add_message_handler(handle_file_protection_enable_msg);
-    dispatcher->add_message_handler(handle_file_protection_disable_msg);
-    dispatcher->add_message_handler(handle_file_protection_set_msg);
-    dispatcher->add_message_handler(handle_file_protection_clear_msg);
-    dispatcher->add_message_handler(handle_net_protection_enable_msg);
-    dispatcher->add_message_handler(handle_net_protection_disable_msg);
-    dispatcher->add_message_handler(handle_net_protection_insert_msg);
-    dispatcher->add_message_handler(handle_net_protection_delete_msg);
-    dispatcher->add_message_handler(handle_net_protection_clear_msg);
+    dispatcher = std::make_shared<audience>("dispatcher");
+    dispatcher->add_message_handler("user::proc::enable", handle_process_protection_enable_msg);
+    dispatcher->add_message_handler("user::proc::disable", handle_process_protection_disable_msg);
+    dispatcher->add_message_handler("user::file::enable", handle_file_protection_enable_msg);
+    dispatcher->add_message_handler("user::file::disable", handle_file_protection_disable_msg);
+    dispatcher->add_message_handler("user::file::set", handle_file_protection_set_msg);
+    dispatcher->add_message_handler("user::file::clear", handle_file_protection_clear_msg);
+    dispatcher->add_message_handler("user::net::enable", handle_net_protection_enable_msg);
+    dispatcher->add_message_handler("user::net::disable", handle_net_protection_disable_msg);
+    dispatcher->add_message_handler("user::net::insert", handle_net_protection_insert_msg);
+    dispatcher->add_message_handler("user::net::delete", handle_net_protection_delete_msg);
+    dispatcher->add_message_handler("user::net::clear", handle_net_protection_clear_msg);
 
-    broadcaster::global().add_audience(dispatcher);
+    broadcaster::global().add_audience(dispatcher, {"user::proc::", "user::file::", "user::net::"});
     DBG("dispatcher enter");
     dispatcher->start_consuming_message();
     DBG("dispatcher exit");
@@ -4,265 +4,134 @@
 #include "hackernel/json.h"
 #include "hackernel/net.h"
 #include "hackernel/process.h"
-#include <arpa/inet.h>
+#include "hackernel/schema.h"
 #include <nlohmann/json.hpp>
 #include <string>
 
 namespace hackernel {
 
-bool handle_process_protection_enable_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::proc::enable")
-        return false;
-
+bool handle_process_protection_enable_msg(const message_ptr &msg) {
+    const nlohmann::json &doc = msg->doc();
     int32_t session = doc["session"];
     enable_process_protection(session);
     return true;
 }
 
-bool handle_process_protection_disable_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::proc::disable")
-        return false;
-
+bool handle_process_protection_disable_msg(const message_ptr &msg) {
+    const nlohmann::json &doc = msg->doc();
     int32_t session = doc["session"];
     disable_process_protection(session);
     return true;
 }
 
-bool handle_file_protection_enable_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::file::enable")
-        return false;
-
+bool handle_file_protection_enable_msg(const message_ptr &msg) {
+    const nlohmann::json &doc = msg->doc();
     int32_t session = doc["session"];
     enable_file_protection(session);
     return true;
 }
 
-bool handle_file_protection_disable_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::file::disable")
-        return false;
-
+bool handle_file_protection_disable_msg(const message_ptr &msg) {
+    const nlohmann::json &doc = msg->doc();
     int32_t session = doc["session"];
     disable_file_protection(session);
     return true;
 }
 
-static int check_user_file_set_data(const nlohmann::json &data) {
-    if (!data.contains("path"))
-        goto errout;
-
-    if (!data["path"].is_string())
-        goto errout;
+struct file_set_request {
+    std::string path;
+    int32_t perm;
+    int flag;
+};
 
-    if (!data.contains("perm"))
-        goto errout;
-
-    if (!data["perm"].is_number_integer())
-        goto errout;
-
-    if (!data.contains("flag"))
-        goto errout;
-
-    if (!data["flag"].is_number_integer())
-        goto errout;
-    return 0;
-
-errout:
-    WARN("invalid argument=[%s]", json::dump(data).data());
-    return -EINVAL;
-}
-
-bool handle_file_protection_set_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::file::set")
-        return false;
+static const schema<file_set_request> file_set_schema = schema<file_set_request>()
+                                                            .string("path", &file_set_request::path)
+                                                            .integer("perm", &file_set_request::perm)
+                                                            .integer("flag", &file_set_request::flag);
 
+bool handle_file_protection_set_msg(const message_ptr &msg) {
+    const nlohmann::json &doc = msg->doc();
     int32_t session = doc["session"];
-    nlohmann::json data = doc["data"];
 
-    if (check_user_file_set_data(data))
+    file_set_request request;
+    if (file_set_schema.decode(doc["data"], request))
         return false;
 
-    std::string path = data["path"];
-    int32_t perm = data["perm"];
-    int flag = data["flag"];
-    set_file_protection(session, path.data(), perm, flag);
+    set_file_protection(session, request.path.data(), request.perm, request.flag);
     return true;
 }
 
-bool handle_file_protection_clear_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::file::clear")
-        return false;
-
+bool handle_file_protection_clear_msg(const message_ptr &msg) {
+    const nlohmann::json &doc = msg->doc();
     int32_t session = doc["session"];
     clear_file_protection(session);
     return true;
 }
 
-bool handle_net_protection_enable_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::net::enable")
-        return false;
-
+bool handle_net_protection_enable_msg(const message_ptr &msg) {
+    const nlohmann::json &doc = msg->doc();
     int32_t session = doc["session"];
     enable_net_protection(session);
     return true;
 }
 
-bool handle_net_protection_disable_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::net::disable")
-        return false;
-
+bool handle_net_protection_disable_msg(const message_ptr &msg) {
+    const nlohmann::json &doc = msg->doc();
     int32_t session = doc["session"];
     disable_net_protection(session);
     return true;
 }
 
-static int check_net_protection_insert_data(const nlohmann::json &data) {
-    if (!data.contains("id"))
-        goto errout;
-    if (!data["id"].is_number_integer())
-        goto errout;
-    if (!data.contains("priority"))
-        goto errout;
-    if (!data["priority"].is_number_integer())
-        goto errout;
-    if (!data.contains("addr"))
-        goto errout;
-    if (!data["addr"].contains("src"))
-        goto errout;
-    if (!data["addr"]["src"].contains("begin"))
-        goto errout;
-    if (!data["addr"]["src"]["begin"].is_string())
-        goto errout;
-    if (!data["addr"]["src"].contains("end"))
-        goto errout;
-    if (!data["addr"]["src"]["end"].is_string())
-        goto errout;
-    if (!data["addr"].contains("dst"))
-        goto errout;
-    if (!data["addr"]["dst"].contains("begin"))
-        goto errout;
-    if (!data["addr"]["dst"]["begin"].is_string())
-        goto errout;
-    if (!data["addr"]["dst"].contains("end"))
-        goto errout;
-    if (!data["addr"]["dst"]["end"].is_string())
-        goto errout;
-    if (!data.contains("protocol"))
-        goto errout;
-    if (!data["protocol"].contains("begin"))
-        goto errout;
-    if (!data["protocol"]["begin"].is_number_integer())
-        goto errout;
-    if (!data["protocol"].contains("end"))
-        goto errout;
-    if (!data["protocol"]["end"].is_number_integer())
-        goto errout;
-    if (!data.contains("port"))
-        goto errout;
-    if (!data["port"].contains("src"))
-        goto errout;
-    if (!data["port"]["src"].contains("begin"))
-        goto errout;
-    if (!data["port"]["src"]["begin"].is_number_integer())
-        goto errout;
-    if (!data["port"]["src"].contains("end"))
-        goto errout;
-    if (!data["port"]["src"]["end"].is_number_integer())
-        goto errout;
-    if (!data["port"].contains("dst"))
-        goto errout;
-    if (!data["port"]["dst"].contains("begin"))
-        goto errout;
-    if (!data["port"]["dst"]["begin"].is_number_integer())
-        goto errout;
-    if (!data["port"]["dst"].contains("end"))
-        goto errout;
-    if (!data["port"]["dst"]["end"].is_number_integer())
-        goto errout;
-    if (!data.contains("flags"))
-        goto errout;
-    if (!data["flags"].is_number_integer())
-        goto errout;
-    if (!data.contains("response"))
-        goto errout;
-    if (!data["response"].is_number_integer())
-        goto errout;
-    return 0;
-
-errout:
-    WARN("invalid argument=[%s]", json::dump(data).data());
-    return -EINVAL;
-}
-
-bool handle_net_protection_insert_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::net::insert")
-        return false;
-
+static const schema<net_policy> net_policy_schema =
+    schema<net_policy>()
+        .integer("id", &net_policy::id)
+        .integer("priority", &net_policy::priority)
+        .ipv4("addr.src.begin", [](net_policy &policy) -> auto & { return policy.addr.src.begin; })
+        .ipv4("addr.src.end", [](net_policy &policy) -> auto & { return policy.addr.src.end; })
+        .ipv4("addr.dst.begin", [](net_policy &policy) -> auto & { return policy.addr.dst.begin; })
+        .ipv4("addr.dst.end", [](net_policy &policy) -> auto & { return policy.addr.dst.end; })
+        .integer("protocol.begin", [](net_policy &policy) -> auto & { return policy.protocol.begin; })
+        .integer("protocol.end", [](net_policy &policy) -> auto & { return policy.protocol.end; })
+        .integer("port.src.begin", [](net_policy &policy) -> auto & { return policy.port.src.begin; })
+        .integer("port.src.end", [](net_policy &policy) -> auto & { return policy.port.src.end; })
+        .integer("port.dst.begin", [](net_policy &policy) -> auto & { return policy.port.dst.begin; })
+        .integer("port.dst.end", [](net_policy &policy) -> auto & { return policy.port.dst.end; })
+        .integer("flags", &net_policy::flags)
+        .integer("response", &net_policy::response);
+
+bool handle_net_protection_insert_msg(const message_ptr &msg) {
+    const nlohmann::json &doc = msg->doc();
     int32_t session = doc["session"];
-    nlohmann::json data = doc["data"];
-    if (check_net_protection_insert_data(data))
-        return false;
+
     net_policy policy;
-    policy.id = data["id"];
-    policy.priority = data["priority"];
-    policy.addr.src.begin = ntohl(inet_addr(std::string(data["addr"]["src"]["begin"]).data()));
-    policy.addr.src.end = ntohl(inet_addr(std::string(data["addr"]["src"]["end"]).data()));
-    policy.addr.dst.begin = ntohl(inet_addr(std::string(data["addr"]["dst"]["begin"]).data()));
-    policy.addr.dst.end = ntohl(inet_addr(std::string(data["addr"]["dst"]["end"]).data()));
-    policy.protocol.begin = data["protocol"]["begin"];
-    policy.protocol.end = data["protocol"]["end"];
-    policy.port.src.begin = data["port"]["src"]["begin"];
-    policy.port.src.end = data["port"]["src"]["end"];
-    policy.port.dst.begin = data["port"]["dst"]["begin"];
-    policy.port.dst.end = data["port"]["dst"]["end"];
-    policy.flags = data["flags"];
-    policy.response = data["response"];
+    if (net_policy_schema.decode(doc["data"], policy))
+        return false;
 
     insert_net_policy(session, &policy);
     return true;
 }
 
-static int check_net_protection_delete_data(const nlohmann::json &data) {
-    if (!data.contains("id"))
-        goto errout;
-    if (!data["id"].is_number_integer())
-        goto errout;
-    return 0;
-
-errout:
-    WARN("invalid argument=[%s]", json::dump(data).data());
-    return -EINVAL;
-}
+struct net_delete_request {
+    net_policy_id id;
+};
 
-bool handle_net_protection_delete_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::net::delete")
-        return false;
+static const schema<net_delete_request> net_delete_schema =
+    schema<net_delete_request>().integer("id", &net_delete_request::id);
 
+bool handle_net_protection_delete_msg(const message_ptr &msg) {
+    const nlohmann::json &doc = msg->doc();
     int32_t session = doc["session"];
 
-    nlohmann::json data = doc["data"];
-    if (check_net_protection_delete_data(data))
+    net_delete_request request;
+    if (net_delete_schema.decode(doc["data"], request))
         return false;
 
-    uint32_t id = data["id"];
-    delete_net_policy(session, id);
+    delete_net_policy(session, request.id);
     return true;
 }
 
-bool handle_net_protection_clear_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::net::clear")
-        return false;
-
+bool handle_net_protection_clear_msg(const message_ptr &msg) {
+    const nlohmann::json &doc = msg->doc();
     int32_t session = doc["session"];
     clear_net_policy(session);
     return true;
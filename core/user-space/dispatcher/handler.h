@@ -2,23 +2,24 @@
 #ifndef DISPATCHER_HANDLER_H
 #define DISPATCHER_HANDLER_H
 
+#include "hackernel/broadcaster.h"
 #include <string>
 
 namespace hackernel {
 
-bool handle_process_protection_enable_msg(const std::string &msg);
-bool handle_process_protection_disable_msg(const std::string &msg);
+bool handle_process_protection_enable_msg(const message_ptr &msg);
+bool handle_process_protection_disable_msg(const message_ptr &msg);
 
-bool handle_file_protection_enable_msg(const std::string &msg);
-bool handle_file_protection_disable_msg(const std::string &msg);
-bool handle_file_protection_set_msg(const std::string &msg);
-bool handle_file_protection_clear_msg(const std::string &msg);
+bool handle_file_protection_enable_msg(const message_ptr &msg);
+bool handle_file_protection_disable_msg(const message_ptr &msg);
+bool handle_file_protection_set_msg(const message_ptr &msg);
+bool handle_file_protection_clear_msg(const message_ptr &msg);
 
-bool handle_net_protection_enable_msg(const std::string &msg);
-bool handle_net_protection_disable_msg(const std::string &msg);
-bool handle_net_protection_insert_msg(const std::string &msg);
-bool handle_net_protection_delete_msg(const std::string &msg);
-bool handle_net_protection_clear_msg(const std::string &msg);
+bool handle_net_protection_enable_msg(const message_ptr &msg);
+bool handle_net_protection_disable_msg(const message_ptr &msg);
+bool handle_net_protection_insert_msg(const message_ptr &msg);
+bool handle_net_protection_delete_msg(const message_ptr &msg);
+bool handle_net_protection_clear_msg(const message_ptr &msg);
 
 } // namespace hackernel
 
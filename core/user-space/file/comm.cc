@@ -3,6 +3,7 @@
 #include "hackernel/broadcaster.h"
 #include "hackernel/file.h"
 #include "hackernel/ipc.h"
+#include "hackernel/report.h"
 #include "nlc/netlink.h"
 #include <netlink/genl/genl.h>
 #include <netlink/msg.h>
@@ -46,7 +47,7 @@ int clear_file_protection(int32_t session) {
     return update_file_protection_status(session, FILE_PROTECT_CLEAR);
 }
 
-static int generate_file_protection_enable_msg(const int32_t &session, const int32_t &code, std::string &msg) {
+static int generate_file_protection_enable_msg(const int32_t &session, const int32_t &code, message_ptr &msg) {
     nlohmann::json doc;
     doc["type"] = "kernel::file::enable";
     doc["code"] = code;
@@ -54,7 +55,7 @@ static int generate_file_protection_enable_msg(const int32_t &session, const int
     return 0;
 }
 
-static int generate_file_protection_disable_msg(const int32_t &session, const int32_t &code, std::string &msg) {
+static int generate_file_protection_disable_msg(const int32_t &session, const int32_t &code, message_ptr &msg) {
     nlohmann::json doc;
     doc["type"] = "kernel::file::disable";
     doc["code"] = code;
@@ -63,7 +64,7 @@ static int generate_file_protection_disable_msg(const int32_t &session, const in
 }
 
 static int generate_file_protection_set_msg(const int32_t &session, const int32_t &code, unsigned long fsid,
-                                            unsigned long ino, std::string &msg) {
+                                            unsigned long ino, message_ptr &msg) {
     nlohmann::json doc;
     doc["type"] = "kernel::file::set";
     doc["code"] = code;
@@ -74,18 +75,12 @@ static int generate_file_protection_set_msg(const int32_t &session, const int32_
 }
 
 static int generate_file_protection_report_msg(const char *name, file_perm perm, unsigned long fsid, unsigned long ino,
-                                               std::string &msg) {
-    nlohmann::json doc;
-    doc["type"] = "kernel::file::report";
-    doc["name"] = name;
-    doc["perm"] = perm;
-    doc["fsid"] = fsid;
-    doc["ino"] = ino;
-    msg = generate_system_broadcast_msg(doc);
+                                               message_ptr &msg) {
+    msg = make_file_report_msg(name, perm, fsid, ino);
     return 0;
 }
 
-static int generate_file_protection_clear_msg(const int32_t &session, const int32_t &code, std::string &msg) {
+static int generate_file_protection_clear_msg(const int32_t &session, const int32_t &code, message_ptr &msg) {
     nlohmann::json doc;
     doc["type"] = "kernel::file::clear";
     doc["code"] = code;
@@ -137,7 +132,7 @@ int handle_genl_file_protection(struct nl_cache_ops *unused, struct genl_cmd *ge
     file_perm perm;
     int32_t session;
     int code;
-    std::string msg;
+    message_ptr msg;
     unsigned long fsid;
     unsigned long ino;
 
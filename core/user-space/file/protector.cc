@@ -15,13 +15,13 @@ file_protector &file_protector::global() {
 }
 
 int file_protector::start() {
-    audience_ = std::make_shared<audience>();
+    audience_ = std::make_shared<audience>("file");
     if (!audience_) {
         ERR("make audience failed");
         return -ENOMEM;
     }
-    audience_->add_message_handler([&](const std::string &msg) { return handle_file_protection_msg(msg); });
-    broadcaster::global().add_audience(audience_);
+    audience_->add_message_handler([&](const message_ptr &msg) { return handle_file_protection_msg(msg); });
+    broadcaster::global().add_audience(audience_, {"user::file::"});
 
     update_thread_name("file");
     audience_->start_consuming_message();
@@ -29,12 +29,8 @@ int file_protector::start() {
     return 0;
 }
 
-bool file_protector::handle_file_protection_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (!doc["type"].is_string())
-        return false;
-
-    const std::string &type = doc["type"];
+bool file_protector::handle_file_protection_msg(const message_ptr &msg) {
+    std::string_view type = msg->type();
     if (type == "user::file::enable") {
         enabled_ = true;
         return true;
@@ -44,7 +40,9 @@ bool file_protector::handle_file_protection_msg(const std::string &msg) {
         return true;
     }
     if (type == "user::file::set") {
-        nlohmann::json &data = doc["data"];
+        const nlohmann::json &data = msg->doc()["data"];
+        if (!data.contains("path") || !data.contains("perm"))
+            return false;
         if (!data["path"].is_string() || !data["perm"].is_number_unsigned())
             return false;
         const std::string path = data["path"];
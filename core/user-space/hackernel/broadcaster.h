@@ -2,51 +2,165 @@
 #ifndef HACKERNEL_BROADCASTER_H
 #define HACKERNEL_BROADCASTER_H
 
-#include <condition_variable>
+#include "hackernel/json.h"
+#include "hackernel/queue.h"
+#include <atomic>
 #include <functional>
 #include <iostream>
 #include <list>
 #include <memory>
+#include <memory_resource>
 #include <mutex>
-#include <queue>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 namespace hackernel {
 
 int stop_all_audience();
 
+class message;
 class broadcaster;
 class audience;
 
+typedef std::shared_ptr<const message> message_ptr;
+typedef std::function<bool(const message_ptr &)> message_handler;
+typedef std::function<size_t(const message_ptr &)> message_key;
+
+static const size_t MESSAGE_ARENA_SIZE = 512;
+
+// 广播中传递的消息,创建后不可修改,所有 audience 共享同一份解析结果.
+// 消息可以由文档创建,也可以由已经序列化好的 data 部分创建,此时文档在首次使用时才解析
+class message {
+public:
+    explicit message(nlohmann::json doc);
+    message(int32_t session, std::string_view type, std::string_view payload);
+
+    static message_ptr make(nlohmann::json doc);
+    static message_ptr make(int32_t session, std::string_view type, std::string_view payload);
+    static message_ptr parse(const std::string &text);
+
+    const nlohmann::json &doc() const;
+    int32_t session() const;
+    std::string_view type() const;
+    const std::string &text() const;
+    // data 部分序列化后的文本,即推送给订阅者的内容
+    std::string_view payload() const;
+    // 按客户端协商的编码格式序列化的 data 部分,每种格式只生成一次
+    std::string_view payload(wire_format format) const;
+    bool is_audit() const;
+
+private:
+    void init_type();
+
+private:
+    // 每个事件自带的内存池,与消息在同一次分配中创建,随消息一起释放.
+    // 类型和 payload 从这里分配,大多数事件整个生命周期只有一次内存分配.
+    // 内存池不是线程安全的,除构造外只有 payload_ 在 call_once 中使用它
+    char arena_buffer_[MESSAGE_ARENA_SIZE];
+    std::pmr::monotonic_buffer_resource arena_{arena_buffer_, sizeof(arena_buffer_), std::pmr::new_delete_resource()};
+
+    int32_t session_ = 0;
+    std::pmr::string type_{&arena_};
+    // 各类 report 事件,队列积压时可以丢弃
+    bool audit_ = false;
+    mutable std::once_flag doc_flag_;
+    mutable nlohmann::json doc_;
+    mutable std::once_flag payload_flag_;
+    mutable std::pmr::string payload_{&arena_};
+    mutable std::once_flag text_flag_;
+    mutable std::string text_;
+    mutable std::once_flag binary_flag_[2];
+    mutable std::string binary_[2];
+};
+
+// 以 std::string 为键的容器用 std::string_view 查找时不需要构造临时对象
+struct string_hash {
+    typedef void is_transparent;
+    size_t operator()(std::string_view value) const {
+        return std::hash<std::string_view>()(value);
+    }
+};
+
+static const size_t AUDIENCE_QUEUE_CAPACITY = 16384;
+static const size_t AUDIENCE_AUDIT_BATCH = 32;
+
 class audience {
+    // 每个工作线程有控制和审计两条队列,共享同一个休眠唤醒
+    struct lanes {
+        std::shared_ptr<hackernel::parking> wakeup;
+        mpsc_queue<message_ptr> control;
+        mpsc_queue<message_ptr> audit;
+
+        lanes(size_t capacity, overflow_policy policy);
+    };
+
 public:
+    audience(const std::string &name = "", size_t capacity = AUDIENCE_QUEUE_CAPACITY,
+             overflow_policy policy = overflow_policy::drop_expendable, size_t workers = 1);
+
     void set_broadcaster(std::weak_ptr<broadcaster> broadcaster);
-    void save_message(std::string message);
-    void start_consuming_message();
-    void add_message_handler(std::function<bool(const std::string &)> new_handler);
+    void set_message_key(message_key key);
+    size_t worker_count() const;
+    void save_message(message_ptr message);
+    // 整批写入后每个工作线程只唤醒一次
+    void save_messages(const std::vector<message_ptr> &messages);
+    // 与 save_messages 相同但不等待队列出现空位,没有写入的消息追加到 rejected
+    void offer_messages(const std::vector<message_ptr> &messages, std::vector<message_ptr> &rejected);
+    void start_consuming_message(size_t worker = 0);
+    void add_message_handler(message_handler new_handler);
+    void add_message_handler(const std::string &type, message_handler new_handler);
     void stop_consuming_message();
+    nlohmann::json stats() const;
 
 private:
-    int wait_message(std::string &message);
+    size_t select_worker(const message_ptr &message);
+    int wait_message(lanes &current, std::vector<message_ptr> &messages);
+    void handle_message(const message_ptr &message);
+    static message_handler wrap_message_handler(message_handler handler);
 
 private:
+    std::string name_;
     std::weak_ptr<broadcaster> bind_broadcaster_;
-    std::queue<std::string> message_queue_;
-    std::mutex mutex_;
-    std::condition_variable cv_;
-    bool running_ = false;
-    std::list<std::function<bool(const std::string &)>> handlers_;
+    // 每个工作线程独占一组队列,相同 key 的消息总是由同一个线程处理
+    std::vector<std::unique_ptr<lanes>> lanes_;
+    message_key key_ = nullptr;
+    std::atomic<bool> running_ = false;
+    // 按消息类型注册的处理函数只需一次查找,未命中时再依次尝试通用处理函数
+    std::unordered_map<std::string, message_handler, string_hash, std::equal_to<>> typed_handlers_;
+    std::list<message_handler> handlers_;
 };
 
+// 消息类型前缀,如 "user::file::",为空表示接收全部消息
+typedef std::vector<std::string> message_topics;
+
 class broadcaster : public std::enable_shared_from_this<broadcaster> {
+    struct subscriber {
+        std::shared_ptr<hackernel::audience> target;
+        message_topics topics;
+
+        bool match(std::string_view type) const;
+    };
+    typedef std::vector<subscriber> subscriber_list;
+
 public:
     static broadcaster &global();
-    void add_audience(std::shared_ptr<audience> audience);
+    void add_audience(std::shared_ptr<audience> audience, message_topics topics = {});
     void del_audience(std::shared_ptr<audience> audience);
-    void broadcast(std::string message);
+    void broadcast(message_ptr message);
+    void broadcast(const std::vector<message_ptr> &messages);
+    // 不阻塞的批量广播,任意一个 audience 的队列已满时该消息追加到 rejected, 可能重复
+    void offer(const std::vector<message_ptr> &messages, std::vector<message_ptr> &rejected);
+    void broadcast(nlohmann::json doc);
+    void broadcast(const std::string &message);
     void notify_audience_stop();
+    nlohmann::json stats();
 
 private:
-    std::list<std::shared_ptr<audience>> audience_;
+    // 写时复制,广播时只读取快照,增删 audience 时才需要加锁
+    std::atomic<std::shared_ptr<const subscriber_list>> audience_ = std::make_shared<const subscriber_list>();
     std::mutex mutex_;
 };
 
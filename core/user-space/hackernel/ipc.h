@@ -5,33 +5,41 @@
 #include "broadcaster.h"
 #include "hackernel/json.h"
 #include "hackernel/util.h"
+#include <memory>
 #include <nlohmann/json.hpp>
 #include <string>
 #include <sys/un.h>
 
 namespace hackernel {
 
+namespace ipc {
+struct stream_conn;
+}; // namespace ipc
+
 typedef int32_t session;
-typedef std::shared_ptr<struct sockaddr_un> user_id;
+typedef struct sockaddr_un user_id;
 typedef int user_id_size;
 
 struct user_conn {
     user_id peer;
     user_id_size len;
     nlohmann::json extra;
+    wire_format format = wire_format::json;
+    // 通过连接发送请求的客户端,数据报客户端为空
+    std::shared_ptr<ipc::stream_conn> stream;
 };
 
 static const session SYSTEM_SESSION = 0;
 
-static inline std::string generate_broadcast_msg(const int32_t &session, const nlohmann::json &data) {
+static inline message_ptr generate_broadcast_msg(const int32_t &session, const nlohmann::json &data) {
     nlohmann::json doc;
     doc["session"] = session;
     doc["type"] = data["type"];
     doc["data"] = data;
-    return json::dump(doc);
+    return message::make(std::move(doc));
 }
 
-static inline std::string generate_system_broadcast_msg(const nlohmann::json &data) {
+static inline message_ptr generate_system_broadcast_msg(const nlohmann::json &data) {
     return generate_broadcast_msg(SYSTEM_SESSION, data);
 }
 
@@ -3,16 +3,70 @@
 #define HACKERNEL_JSON_H
 
 #include "hackernel/util.h"
+#include <charconv>
+#include <concepts>
+#include <functional>
 #include <nlohmann/json.hpp>
 #include <string>
+#include <string_view>
 
 namespace hackernel {
 
+// 与客户端通信的编码格式,客户端可以按需切换为二进制编码,默认为文本 Json
+enum class wire_format {
+    json,
+    msgpack,
+    cbor,
+};
+
 namespace json {
 
+// 嵌套层数的上限,合法请求的嵌套远小于该值.二进制格式的解析和所有格式的序列化都是递归的,
+// 不限制时嵌套过深的请求会耗尽栈
+static const size_t JSON_DEPTH_MAX = 64;
+
 std::string dump(const nlohmann::json &doc);
 nlohmann::json parse(const std::string &msg);
 
+int parse_format(const std::string &name, wire_format &format);
+std::string encode(const nlohmann::json &doc, wire_format format);
+// 与 parse 相同,解析失败或嵌套超过 JSON_DEPTH_MAX 层时抛出异常
+nlohmann::json decode(std::string_view msg, wire_format format);
+// 不解析,只统计 Json 文本中括号的嵌套层数,超出 limit 时返回 -EINVAL
+int check_depth(std::string_view msg, size_t limit = JSON_DEPTH_MAX);
+
+// 依次回调顶层对象的键和值的原始文本,不构造文档.
+// 只做最基本的扫描,调用者需要先保证 msg 是合法的 Json,顶层不是对象时返回 -EINVAL
+int scan(std::string_view msg, const std::function<void(const std::string &key, std::string_view value)> &field);
+
+// 不经过 nlohmann::json 直接向缓冲区追加对象,用于高频事件的序列化.
+// 键名由调用者保证无需转义,按字典序写入时输出与 dump 完全一致
+class writer {
+public:
+    explicit writer(std::string &buffer);
+
+    writer &begin();
+    writer &end();
+    writer &field(const char *key, std::string_view value);
+    writer &field_ipv4(const char *key, uint32_t addr);
+
+    template <std::integral T> writer &field(const char *key, T value) {
+        char number[24];
+        auto result = std::to_chars(number, number + sizeof(number), value);
+        append_key(key);
+        buffer_.append(number, result.ptr);
+        return *this;
+    }
+
+private:
+    void append_key(const char *key);
+    void append_escaped(std::string_view value);
+
+private:
+    std::string &buffer_;
+    bool first_ = true;
+};
+
 }; // namespace json
 
 }; // namespace hackernel
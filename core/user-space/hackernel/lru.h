@@ -2,10 +2,15 @@
 #ifndef HACKERNEL_LRU_H
 #define HACKERNEL_LRU_H
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
+#include <vector>
 
 namespace hackernel {
 
@@ -87,6 +92,184 @@ public:
     }
 };
 
+// 分片的 LRU,每个分片有独立的锁和预先分配的节点池,节点通过下标串成链表,插入时不再分配链表节点.
+// 查找返回共享的只读句柄而不是拷贝,条目可以设置存活时间,过期的条目在访问或被淘汰时删除
+template <typename Key, typename Value, typename Hash = std::hash<Key>> class sharded_lru {
+public:
+    typedef std::shared_ptr<const Value> handle;
+    typedef std::chrono::steady_clock clock;
+
+private:
+    static const uint32_t NIL = UINT32_MAX;
+
+    struct node {
+        Key key;
+        handle value;
+        // 默认值表示永不过期
+        clock::time_point expire;
+        uint32_t prev = NIL;
+        uint32_t next = NIL;
+    };
+
+    struct alignas(64) shard {
+        std::mutex lock;
+        std::vector<node> nodes;
+        std::unordered_map<Key, uint32_t, Hash> index;
+        uint32_t head = NIL;
+        uint32_t tail = NIL;
+        uint32_t free = NIL;
+    };
+
+private:
+    std::unique_ptr<shard[]> shards_;
+    size_t shard_count_ = 1;
+    clock::duration ttl_ = clock::duration::zero();
+
+public:
+    static const size_t SHARD_MAX = 16;
+
+    sharded_lru(size_t capacity = 1, clock::duration ttl = clock::duration::zero()) : ttl_(ttl) {
+        set_capacity(capacity);
+    }
+
+    sharded_lru(const sharded_lru &) = delete;
+    sharded_lru &operator=(const sharded_lru &) = delete;
+
+    int get(const Key &key, handle &value) {
+        shard &current = select(key);
+        std::lock_guard<std::mutex> lock(current.lock);
+
+        auto it = current.index.find(key);
+        if (it == current.index.end())
+            return -ESRCH;
+
+        uint32_t pos = it->second;
+        node &item = current.nodes[pos];
+        if (expired(item, clock::now())) {
+            remove(current, pos);
+            return -ESRCH;
+        }
+
+        unlink(current, pos);
+        link_front(current, pos);
+        value = item.value;
+        return 0;
+    }
+
+    // ttl 为零时使用默认的存活时间
+    int put(const Key &key, Value value, clock::duration ttl = clock::duration::zero()) {
+        handle shared = std::make_shared<const Value>(std::move(value));
+        if (ttl == clock::duration::zero())
+            ttl = ttl_;
+        clock::time_point expire = ttl == clock::duration::zero() ? clock::time_point() : clock::now() + ttl;
+
+        shard &current = select(key);
+        std::lock_guard<std::mutex> lock(current.lock);
+
+        uint32_t pos;
+        auto it = current.index.find(key);
+        if (it != current.index.end()) {
+            pos = it->second;
+            unlink(current, pos);
+        } else {
+            if (current.free == NIL)
+                remove(current, current.tail);
+            pos = current.free;
+            current.free = current.nodes[pos].next;
+            current.nodes[pos].key = key;
+            current.index.emplace(key, pos);
+        }
+
+        node &item = current.nodes[pos];
+        item.value = std::move(shared);
+        item.expire = expire;
+        link_front(current, pos);
+        return 0;
+    }
+
+    int erase(const Key &key) {
+        shard &current = select(key);
+        std::lock_guard<std::mutex> lock(current.lock);
+
+        auto it = current.index.find(key);
+        if (it == current.index.end())
+            return -ESRCH;
+        remove(current, it->second);
+        return 0;
+    }
+
+    // 重新分配节点池,已有的条目会被清空,只应在初始化时调用
+    int set_capacity(size_t capacity) {
+        capacity = std::max<size_t>(capacity, 1);
+        size_t count = 1;
+        while (count < SHARD_MAX && count * 2 <= capacity)
+            count <<= 1;
+
+        shards_ = std::make_unique<shard[]>(count);
+        shard_count_ = count;
+        for (size_t i = 0; i < count; ++i) {
+            shard &current = shards_[i];
+            size_t size = capacity / count + (i < capacity % count);
+            current.nodes.resize(size);
+            current.index.reserve(size);
+            for (uint32_t pos = 0; pos < size; ++pos)
+                current.nodes[pos].next = pos + 1 < size ? pos + 1 : NIL;
+            current.free = 0;
+        }
+        return 0;
+    }
+
+    // 只影响之后写入的条目
+    int set_ttl(clock::duration ttl) {
+        ttl_ = ttl;
+        return 0;
+    }
+
+private:
+    shard &select(const Key &key) {
+        size_t hash = Hash()(key);
+        return shards_[(hash ^ (hash >> 16)) & (shard_count_ - 1)];
+    }
+
+    static bool expired(const node &item, clock::time_point now) {
+        return item.expire != clock::time_point() && now >= item.expire;
+    }
+
+    static void unlink(shard &current, uint32_t pos) {
+        node &item = current.nodes[pos];
+        if (item.prev != NIL)
+            current.nodes[item.prev].next = item.next;
+        else
+            current.head = item.next;
+        if (item.next != NIL)
+            current.nodes[item.next].prev = item.prev;
+        else
+            current.tail = item.prev;
+        item.prev = item.next = NIL;
+    }
+
+    static void link_front(shard &current, uint32_t pos) {
+        node &item = current.nodes[pos];
+        item.prev = NIL;
+        item.next = current.head;
+        if (current.head != NIL)
+            current.nodes[current.head].prev = pos;
+        current.head = pos;
+        if (current.tail == NIL)
+            current.tail = pos;
+    }
+
+    // 释放句柄并归还到空闲链表,仍被持有的句柄不受影响
+    static void remove(shard &current, uint32_t pos) {
+        node &item = current.nodes[pos];
+        unlink(current, pos);
+        current.index.erase(item.key);
+        item.value.reset();
+        item.next = current.free;
+        current.free = pos;
+    }
+};
+
 }; // namespace hackernel
 
 #endif
@@ -0,0 +1,279 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#ifndef HACKERNEL_QUEUE_H
+#define HACKERNEL_QUEUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace hackernel {
+
+// 队列已满时的处理策略
+enum class overflow_policy {
+    // 阻塞生产者直到有空位
+    block,
+    // 丢弃队列中最早的消息
+    drop_oldest,
+    // 丢弃正在写入的消息
+    drop_newest,
+    // 队列已满时仅丢弃可丢弃的消息(如审计事件),其他消息阻塞等待.
+    // 控制消息与审计事件使用各自的队列,不需要为控制消息预留容量
+    drop_expendable,
+};
+
+// 消费者线程的休眠与唤醒,可以由同一消费者的多个队列共享.
+// 通过 std::atomic::wait 休眠,在 Linux 上即为 futex,
+// 仅当消费者确实在休眠时生产者才会发起唤醒的系统调用.
+class parking {
+private:
+    std::atomic<uint32_t> epoch_ = 0;
+    std::atomic<bool> parked_ = false;
+    std::atomic<bool> closed_ = false;
+
+public:
+    // 生产者在写入数据后调用
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked_.load()) {
+            epoch_.fetch_add(1);
+            epoch_.notify_one();
+        }
+    }
+
+    // ready 返回 true 或者已关闭时不进入休眠
+    template <typename Ready> void wait(Ready ready) {
+        uint32_t epoch = epoch_.load();
+        parked_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready() && !closed_.load())
+            epoch_.wait(epoch);
+        parked_.store(false);
+    }
+
+    void close() {
+        closed_.store(true);
+        epoch_.fetch_add(1);
+        epoch_.notify_all();
+    }
+
+    bool closed() const {
+        return closed_.load();
+    }
+};
+
+// 多生产者单消费者的有界无锁队列,基于每个槽位带序号的环形数组,
+// 生产者和消费者都只通过 CAS 竞争位置,消费者一次取走全部消息.
+// drop_oldest 策略需要生产者弹出队首,因此出队同样是线程安全的.
+template <typename T> class mpsc_queue {
+    struct cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+private:
+    std::unique_ptr<cell[]> cells_;
+    size_t mask_;
+    size_t capacity_;
+    overflow_policy policy_;
+
+    alignas(64) std::atomic<size_t> enqueue_pos_ = 0;
+    alignas(64) std::atomic<size_t> dequeue_pos_ = 0;
+
+    std::shared_ptr<parking> parking_;
+    std::atomic<uint32_t> space_ = 0;
+    std::atomic<uint32_t> blocked_ = 0;
+
+    std::atomic<uint64_t> pushed_ = 0;
+    std::atomic<uint64_t> dropped_ = 0;
+
+public:
+    mpsc_queue(size_t capacity, overflow_policy policy = overflow_policy::drop_expendable,
+               std::shared_ptr<parking> parking = std::make_shared<hackernel::parking>())
+        : policy_(policy), parking_(parking) {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+
+        cells_ = std::make_unique<cell[]>(size);
+        for (size_t i = 0; i < size; ++i)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+
+        mask_ = size - 1;
+        capacity_ = size;
+    }
+
+    mpsc_queue(const mpsc_queue &) = delete;
+    mpsc_queue &operator=(const mpsc_queue &) = delete;
+
+    // 返回 false 表示消息按照策略被丢弃.
+    // 批量写入时可以暂不唤醒消费者,写完整批后再调用一次 notify
+    bool push(T value, bool expendable = false, bool wakeup = true) {
+        if (parking_->closed())
+            return false;
+
+        while (!try_push(value)) {
+            switch (policy_) {
+            case overflow_policy::drop_newest:
+                return drop();
+            case overflow_policy::drop_oldest: {
+                T oldest;
+                if (try_pop(oldest))
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            case overflow_policy::drop_expendable:
+                if (expendable)
+                    return drop();
+                [[fallthrough]];
+            case overflow_policy::block:
+                if (!wait_space())
+                    return drop();
+                break;
+            }
+        }
+
+        pushed_.fetch_add(1, std::memory_order_relaxed);
+        if (wakeup)
+            parking_->notify();
+        return true;
+    }
+
+    // 不等待空位,队列已满时返回 false 且不计入丢弃.用于不能阻塞的生产者,例如消费者线程自己
+    bool offer(T value, bool wakeup = true) {
+        if (parking_->closed() || !try_push(value))
+            return false;
+
+        pushed_.fetch_add(1, std::memory_order_relaxed);
+        if (wakeup)
+            parking_->notify();
+        return true;
+    }
+
+    void notify() {
+        parking_->notify();
+    }
+
+    // 以下函数只能由消费者线程调用
+    bool pop(T &value) {
+        if (!try_pop(value))
+            return false;
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (blocked_.load()) {
+            space_.fetch_add(1);
+            space_.notify_all();
+        }
+        return true;
+    }
+
+    size_t drain(std::vector<T> &values) {
+        size_t count = 0;
+        T value;
+        while (pop(value)) {
+            values.push_back(std::move(value));
+            ++count;
+        }
+        return count;
+    }
+
+    void wait() {
+        parking_->wait([&] { return !empty(); });
+    }
+
+    // 唤醒消费者和阻塞的生产者,之后的 wait 立即返回
+    void close() {
+        parking_->close();
+        space_.fetch_add(1);
+        space_.notify_all();
+    }
+
+    bool empty() const {
+        size_t pos = dequeue_pos_.load();
+        size_t sequence = cells_[pos & mask_].sequence.load(std::memory_order_acquire);
+        return (intptr_t)sequence - (intptr_t)(pos + 1) < 0;
+    }
+
+    size_t size() const {
+        size_t enqueue = enqueue_pos_.load(std::memory_order_relaxed);
+        size_t dequeue = dequeue_pos_.load(std::memory_order_relaxed);
+        return enqueue > dequeue ? enqueue - dequeue : 0;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    uint64_t pushed() const {
+        return pushed_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    bool try_push(T &value) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        cell *current;
+        for (;;) {
+            current = &cells_[pos & mask_];
+            size_t sequence = current->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        current->value = std::move(value);
+        current->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &value) {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        cell *current;
+        for (;;) {
+            current = &cells_[pos & mask_];
+            size_t sequence = current->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(current->value);
+        current->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool wait_space() {
+        // 批量写入时消费者可能还没有被唤醒
+        parking_->notify();
+
+        uint32_t space = space_.load();
+        blocked_.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (size() >= capacity_ && !parking_->closed())
+            space_.wait(space);
+        blocked_.fetch_sub(1);
+        return !parking_->closed();
+    }
+
+    bool drop() {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+};
+
+}; // namespace hackernel
+
+#endif
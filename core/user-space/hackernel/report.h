@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#ifndef HACKERNEL_REPORT_H
+#define HACKERNEL_REPORT_H
+
+#include "hackernel/broadcaster.h"
+#include <cstdint>
+#include <string_view>
+
+namespace hackernel {
+
+// 内核上报事件占据了绝大部分流量,直接序列化到线程本地缓冲区,不构造 nlohmann::json
+message_ptr make_file_report_msg(std::string_view name, int32_t perm, unsigned long fsid, unsigned long ino);
+message_ptr make_net_report_msg(uint8_t protocol, uint32_t saddr, uint32_t daddr, uint16_t sport, uint16_t dport,
+                                uint32_t policy);
+message_ptr make_process_report_msg(std::string_view workdir, std::string_view binary, std::string_view argv);
+
+}; // namespace hackernel
+
+#endif
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#ifndef HACKERNEL_SCHEMA_H
+#define HACKERNEL_SCHEMA_H
+
+#include "hackernel/json.h"
+#include "hackernel/util.h"
+#include <arpa/inet.h>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+namespace hackernel {
+
+// 声明式的请求格式,一次遍历完成校验并解码到结构体,出错时日志中给出字段名.
+// 字段名用 '.' 表示嵌套,如 "addr.src.begin",
+// 目标可以是成员指针,也可以是返回成员引用的函数,如 [](net_policy &p) -> auto & { return p.addr.src.begin; }
+template <typename T> class schema {
+    // 返回 nullptr 表示成功,否则为错误原因
+    typedef std::function<const char *(const nlohmann::json &value, T &target)> decoder;
+
+    struct field {
+        std::string name;
+        std::vector<std::string> path;
+        decoder decode;
+    };
+
+public:
+    template <typename Proj> schema &string(const char *name, Proj proj) {
+        return add(name, [proj](const nlohmann::json &value, T &target) -> const char * {
+            if (!value.is_string())
+                return "expected string";
+            std::invoke(proj, target) = value.get_ref<const std::string &>();
+            return nullptr;
+        });
+    }
+
+    // 超出目标类型范围的数值视为错误,而不是截断
+    template <typename Proj> schema &integer(const char *name, Proj proj) {
+        return add(name, [proj](const nlohmann::json &value, T &target) -> const char * {
+            auto &member = std::invoke(proj, target);
+            typedef std::remove_reference_t<decltype(member)> type;
+            if (!value.is_number_integer())
+                return "expected integer";
+            if (value.is_number_unsigned()) {
+                uint64_t number = value.get<uint64_t>();
+                if (number > (uint64_t)std::numeric_limits<type>::max())
+                    return "out of range";
+                member = (type)number;
+            } else {
+                int64_t number = value.get<int64_t>();
+                if (number < (int64_t)std::numeric_limits<type>::min() ||
+                    (number > 0 && (uint64_t)number > (uint64_t)std::numeric_limits<type>::max()))
+                    return "out of range";
+                member = (type)number;
+            }
+            return nullptr;
+        });
+    }
+
+    // 点分十进制的 IPv4 地址,解码为主机序
+    template <typename Proj> schema &ipv4(const char *name, Proj proj) {
+        return add(name, [proj](const nlohmann::json &value, T &target) -> const char * {
+            struct in_addr addr;
+            if (!value.is_string())
+                return "expected string";
+            if (inet_pton(AF_INET, value.get_ref<const std::string &>().data(), &addr) != 1)
+                return "invalid ipv4 address";
+            std::invoke(proj, target) = ntohl(addr.s_addr);
+            return nullptr;
+        });
+    }
+
+    int decode(const nlohmann::json &data, T &value) const {
+        for (const field &current : fields_) {
+            const nlohmann::json *node = &data;
+            for (const std::string &key : current.path) {
+                if (!node->is_object())
+                    return invalid(current, "missing", data);
+                auto it = node->find(key);
+                if (it == node->end())
+                    return invalid(current, "missing", data);
+                node = &*it;
+            }
+
+            const char *reason = current.decode(*node, value);
+            if (reason)
+                return invalid(current, reason, data);
+        }
+        return 0;
+    }
+
+private:
+    schema &add(const char *name, decoder decode) {
+        field current;
+        current.name = name;
+        std::string key;
+        for (const char *c = name; *c; ++c) {
+            if (*c != '.') {
+                key.push_back(*c);
+                continue;
+            }
+            current.path.push_back(std::move(key));
+            key.clear();
+        }
+        current.path.push_back(std::move(key));
+        current.decode = std::move(decode);
+        fields_.push_back(std::move(current));
+        return *this;
+    }
+
+    static int invalid(const field &current, const char *reason, const nlohmann::json &data) {
+        WARN("invalid argument, field=[%s] reason=[%s] data=[%s]", current.name.data(), reason,
+             json::dump(data).data());
+        return -EINVAL;
+    }
+
+private:
+    std::vector<field> fields_;
+};
+
+}; // namespace hackernel
+
+#endif
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#include "ipc/channel.h"
+#include "hackernel/util.h"
+#include <bit>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace hackernel {
+
+namespace ipc {
+
+shm_channel::~shm_channel() {
+    if (memory_)
+        munmap(memory_, SHM_RING_HEADER_SIZE + capacity_);
+    if (memfd_ != -1)
+        close(memfd_);
+    if (eventfd_ != -1)
+        close(eventfd_);
+}
+
+// 容量向上取整到 2 的幂.共享内存创建后加上封印,客户端无法截断,
+// 否则服务端访问映射时会收到 SIGBUS
+int shm_channel::create(size_t capacity, std::shared_ptr<shm_channel> &channel) {
+    if (capacity < SHM_RING_CAPACITY_MIN || capacity > SHM_RING_CAPACITY_MAX)
+        return -EINVAL;
+
+    auto current = std::make_shared<shm_channel>();
+    current->capacity_ = std::bit_ceil(capacity);
+    size_t size = SHM_RING_HEADER_SIZE + current->capacity_;
+
+    current->memfd_ = memfd_create("hackernel-events", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (current->memfd_ == -1)
+        return -errno;
+    if (ftruncate(current->memfd_, size))
+        return -errno;
+    if (fcntl(current->memfd_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL))
+        return -errno;
+
+    current->eventfd_ = ::eventfd(0, EFD_CLOEXEC);
+    if (current->eventfd_ == -1)
+        return -errno;
+
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, current->memfd_, 0);
+    if (memory == MAP_FAILED)
+        return -errno;
+    current->memory_ = (char *)memory;
+
+    current->header_ = new (current->memory_) shm_ring_header();
+    current->header_->magic = SHM_RING_MAGIC;
+    current->header_->version = SHM_RING_VERSION;
+    current->header_->capacity = current->capacity_;
+    current->header_->data_offset = SHM_RING_HEADER_SIZE;
+    current->data_ = current->memory_ + SHM_RING_HEADER_SIZE;
+
+    channel = current;
+    return 0;
+}
+
+int shm_channel::write(std::string_view record) {
+    size_t need = SHM_RECORD_ALIGN + (record.size() + SHM_RECORD_ALIGN - 1) / SHM_RECORD_ALIGN * SHM_RECORD_ALIGN;
+    if (need > capacity_ / 2)
+        return -EMSGSIZE;
+
+    // tail 由客户端写入,不合理的值按空间已满处理,不会越界
+    uint64_t tail = header_->tail.load(std::memory_order_acquire);
+    uint64_t used = head_ - tail;
+    if (used > capacity_)
+        return -EAGAIN;
+
+    size_t offset = head_ & (capacity_ - 1);
+    size_t contiguous = capacity_ - offset;
+    size_t total = need > contiguous ? contiguous + need : need;
+    if (total > capacity_ - used)
+        return -EAGAIN;
+
+    if (need > contiguous) {
+        uint32_t wrap = SHM_RECORD_WRAP;
+        memcpy(data_ + offset, &wrap, sizeof(wrap));
+        offset = 0;
+    }
+
+    uint32_t size = record.size();
+    memcpy(data_ + offset, &size, sizeof(size));
+    memcpy(data_ + offset + SHM_RECORD_ALIGN, record.data(), record.size());
+
+    head_ += total;
+    header_->head.store(head_, std::memory_order_release);
+    return 0;
+}
+
+// 只有客户端已经休眠时才需要系统调用
+void shm_channel::notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!header_->waiting.exchange(0))
+        return;
+
+    uint64_t value = 1;
+    if (::write(eventfd_, &value, sizeof(value)) == -1)
+        WARN("wake shm channel failed, errno=[%d]", errno);
+}
+
+int shm_channel::memfd() const {
+    return memfd_;
+}
+
+int shm_channel::eventfd() const {
+    return eventfd_;
+}
+
+size_t shm_channel::capacity() const {
+    return capacity_;
+}
+
+}; // namespace ipc
+
+}; // namespace hackernel
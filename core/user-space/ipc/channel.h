@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#ifndef IPC_CHANNEL_H
+#define IPC_CHANNEL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+namespace hackernel {
+
+namespace ipc {
+
+static const uint32_t SHM_RING_MAGIC = 0x484b5352;
+static const uint32_t SHM_RING_VERSION = 1;
+// 头部独占一页,数据区从第二页开始
+static const size_t SHM_RING_HEADER_SIZE = 4096;
+static const size_t SHM_RING_CAPACITY_MIN = 64 * 1024;
+static const size_t SHM_RING_CAPACITY_MAX = 256 * 1024 * 1024;
+static const size_t SHM_RING_CAPACITY_DEFAULT = 4 * 1024 * 1024;
+// 每条记录以 8 字节的头开始,长度为该值时表示跳到数据区开头继续读取
+static const uint32_t SHM_RECORD_WRAP = UINT32_MAX;
+static const size_t SHM_RECORD_ALIGN = 8;
+
+// 共享内存的头部,客户端按相同的布局访问.head 和 tail 是单调递增的字节位置,
+// 对容量取模后得到数据区中的偏移.服务端只写 head, 客户端只写 tail
+struct shm_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    uint64_t data_offset;
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    // 客户端在 eventfd 上休眠前置 1,服务端写入后清零并唤醒
+    alignas(64) std::atomic<uint32_t> waiting;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(sizeof(shm_ring_header) <= SHM_RING_HEADER_SIZE);
+
+// 与本地客户端共享的单生产者事件环,由发送线程写入.
+// 客户端在映射中直接读取事件,只有在它休眠时才需要一次 eventfd 唤醒
+class shm_channel {
+public:
+    ~shm_channel();
+
+    static int create(size_t capacity, std::shared_ptr<shm_channel> &channel);
+    // 空间不足时返回 -EAGAIN, 记录超过容量一半时返回 -EMSGSIZE
+    int write(std::string_view record);
+    void notify();
+
+    int memfd() const;
+    int eventfd() const;
+    size_t capacity() const;
+
+private:
+    int memfd_ = -1;
+    int eventfd_ = -1;
+    char *memory_ = nullptr;
+    size_t capacity_ = 0;
+    shm_ring_header *header_ = nullptr;
+    char *data_ = nullptr;
+    // 客户端可以改写共享内存,写入位置以私有副本为准
+    uint64_t head_ = 0;
+};
+
+}; // namespace ipc
+
+}; // namespace hackernel
+
+#endif
@@ -0,0 +1,336 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#include "ipc/filter.h"
+#include "hackernel/json.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <errno.h>
+
+namespace hackernel {
+
+namespace ipc {
+
+event_fields::event_fields(const message_ptr &msg) : msg_(msg) {}
+
+bool event_fields::find(std::string_view key, std::string_view &value) {
+    if (!scanned_) {
+        scanned_ = true;
+        json::scan(msg_->payload(), [&](const std::string &key, std::string_view value) {
+            fields_.emplace_back(key, value);
+        });
+    }
+
+    for (const auto &[name, raw] : fields_) {
+        if (name == key) {
+            value = raw;
+            return true;
+        }
+    }
+    return false;
+}
+
+// 递归下降解析,边解析边输出后缀表达式:
+// or := and { "||" and }, and := unary { "&&" unary },
+// unary := "!" unary | "(" or ")" | field op literal
+class event_filter::parser {
+public:
+    parser(std::string_view text, event_filter &filter) : text_(text), filter_(filter) {}
+
+    int parse() {
+        if (parse_or())
+            return -EINVAL;
+        skip_space();
+        if (pos_ != text_.size() || filter_.code_.size() > FILTER_CODE_MAX)
+            return -EINVAL;
+        return 0;
+    }
+
+private:
+    void skip_space() {
+        while (pos_ < text_.size() && isspace((unsigned char)text_[pos_]))
+            ++pos_;
+    }
+
+    bool consume(std::string_view token) {
+        skip_space();
+        if (text_.substr(pos_, token.size()) != token)
+            return false;
+        pos_ += token.size();
+        return true;
+    }
+
+    void emit(opcode op) {
+        instruction code;
+        code.op = op;
+        filter_.code_.push_back(std::move(code));
+    }
+
+    int parse_or() {
+        if (parse_and())
+            return -EINVAL;
+        while (consume("||")) {
+            if (parse_and())
+                return -EINVAL;
+            emit(opcode::logical_or);
+        }
+        return 0;
+    }
+
+    int parse_and() {
+        if (parse_unary())
+            return -EINVAL;
+        while (consume("&&")) {
+            if (parse_unary())
+                return -EINVAL;
+            emit(opcode::logical_and);
+        }
+        return 0;
+    }
+
+    int parse_unary() {
+        if (filter_.code_.size() > FILTER_CODE_MAX)
+            return -EINVAL;
+        // "!=" 只出现在字段名之后,这里的 '!' 一定是取反
+        if (consume("!")) {
+            if (parse_unary())
+                return -EINVAL;
+            emit(opcode::logical_not);
+            return 0;
+        }
+        if (consume("(")) {
+            if (parse_or() || !consume(")"))
+                return -EINVAL;
+            return 0;
+        }
+        return parse_compare();
+    }
+
+    int parse_compare() {
+        static const std::pair<std::string_view, opcode> OPERATORS[] = {
+            {"==", opcode::eq},     {"!=", opcode::ne}, {"<=", opcode::le}, {">=", opcode::ge},
+            {"^=", opcode::prefix}, {"*=", opcode::contains}, {"<", opcode::lt}, {">", opcode::gt},
+        };
+
+        instruction code;
+        std::string field;
+        if (parse_field(field))
+            return -EINVAL;
+
+        // 单个 '&' 为按位与, "&&" 由 parse_and 处理
+        skip_space();
+        if (text_.substr(pos_, 1) == "&" && text_.substr(pos_, 2) != "&&") {
+            ++pos_;
+            code.op = opcode::mask;
+        } else {
+            auto it = std::find_if(std::begin(OPERATORS), std::end(OPERATORS),
+                                   [&](const auto &item) { return consume(item.first); });
+            if (it == std::end(OPERATORS))
+                return -EINVAL;
+            code.op = it->second;
+        }
+
+        if (parse_literal(code))
+            return -EINVAL;
+
+        bool numeric = code.op == opcode::lt || code.op == opcode::le || code.op == opcode::gt ||
+                       code.op == opcode::ge || code.op == opcode::mask;
+        bool textual = code.op == opcode::prefix || code.op == opcode::contains;
+        if ((numeric && code.is_string) || (textual && !code.is_string))
+            return -EINVAL;
+
+        code.field = filter_.intern(field);
+        filter_.code_.push_back(std::move(code));
+        return 0;
+    }
+
+    int parse_field(std::string &field) {
+        skip_space();
+        size_t begin = pos_;
+        while (pos_ < text_.size() && (isalnum((unsigned char)text_[pos_]) || text_[pos_] == '_'))
+            ++pos_;
+        if (begin == pos_ || isdigit((unsigned char)text_[begin]))
+            return -EINVAL;
+        field = text_.substr(begin, pos_ - begin);
+        return 0;
+    }
+
+    // 字符串字面量按 Json 字符串的规则转义,与解码后的事件字段比较
+    int parse_literal(instruction &code) {
+        skip_space();
+        if (pos_ < text_.size() && text_[pos_] == '"') {
+            size_t begin = pos_;
+            for (++pos_; pos_ < text_.size() && text_[pos_] != '"'; ++pos_) {
+                if (text_[pos_] == '\\' && ++pos_ == text_.size())
+                    return -EINVAL;
+            }
+            if (pos_ == text_.size())
+                return -EINVAL;
+            ++pos_;
+
+            nlohmann::json literal = nlohmann::json::parse(text_.substr(begin, pos_ - begin), nullptr, false);
+            if (!literal.is_string())
+                return -EINVAL;
+            code.text = literal.get<std::string>();
+            code.is_string = true;
+            return 0;
+        }
+
+        int base = 10;
+        size_t begin = pos_;
+        bool negative = pos_ < text_.size() && text_[pos_] == '-';
+        if (negative)
+            ++begin;
+        if (text_.substr(begin, 2) == "0x") {
+            base = 16;
+            begin += 2;
+        }
+        uint64_t value;
+        auto result = std::from_chars(text_.data() + begin, text_.data() + text_.size(), value, base);
+        if (result.ec != std::errc())
+            return -EINVAL;
+        pos_ = result.ptr - text_.data();
+        code.number = negative ? -(int64_t)value : (int64_t)value;
+        return 0;
+    }
+
+private:
+    std::string_view text_;
+    size_t pos_ = 0;
+    event_filter &filter_;
+};
+
+int event_filter::compile(std::string_view expression, std::shared_ptr<const event_filter> &filter) {
+    if (expression.empty() || expression.size() > FILTER_LENGTH_MAX)
+        return -EINVAL;
+
+    auto current = std::make_shared<event_filter>();
+    current->expression_ = expression;
+    if (parser(expression, *current).parse())
+        return -EINVAL;
+
+    filter = current;
+    return 0;
+}
+
+// 依次拼接各个条件的指令并用 || 连接,字段按名称重新编号.
+// 每段指令求值结束时栈中只留下一个结果,合并后的栈深度只比其中最深的一段多一层
+std::shared_ptr<const event_filter>
+event_filter::any_of(const std::vector<std::shared_ptr<const event_filter>> &filters) {
+    if (filters.size() == 1)
+        return filters.front();
+
+    auto merged = std::make_shared<event_filter>();
+    for (const auto &filter : filters) {
+        merged->expression_ += merged->expression_.empty() ? "(" : " || (";
+        merged->expression_ += filter->expression_ + ")";
+        for (instruction code : filter->code_) {
+            if (code.op < opcode::logical_not)
+                code.field = merged->intern(filter->fields_[code.field]);
+            merged->code_.push_back(std::move(code));
+        }
+        if (&filter != &filters.front()) {
+            instruction code;
+            code.op = opcode::logical_or;
+            merged->code_.push_back(std::move(code));
+        }
+    }
+    return merged;
+}
+
+uint32_t event_filter::intern(const std::string &field) {
+    auto it = std::find(fields_.begin(), fields_.end(), field);
+    if (it != fields_.end())
+        return it - fields_.begin();
+    fields_.push_back(field);
+    return fields_.size() - 1;
+}
+
+// 字符串只在包含转义字符时才需要解码,事件中的字段绝大多数不包含
+bool event_filter::compare(const instruction &code, event_fields &fields) const {
+    std::string_view raw;
+    if (!fields.find(fields_[code.field], raw) || raw.empty())
+        return false;
+
+    if (code.is_string) {
+        if (raw.front() != '"' || raw.size() < 2)
+            return false;
+        std::string decoded;
+        std::string_view value = raw.substr(1, raw.size() - 2);
+        if (value.find('\\') != std::string_view::npos) {
+            nlohmann::json parsed = nlohmann::json::parse(raw, nullptr, false);
+            if (!parsed.is_string())
+                return false;
+            decoded = parsed.get<std::string>();
+            value = decoded;
+        }
+
+        switch (code.op) {
+        case opcode::eq:
+            return value == code.text;
+        case opcode::ne:
+            return value != code.text;
+        case opcode::prefix:
+            return value.starts_with(code.text);
+        case opcode::contains:
+            return value.find(code.text) != std::string_view::npos;
+        default:
+            return false;
+        }
+    }
+
+    int64_t value;
+    auto result = std::from_chars(raw.data(), raw.data() + raw.size(), value);
+    if (result.ec != std::errc() || result.ptr != raw.data() + raw.size())
+        return false;
+
+    switch (code.op) {
+    case opcode::eq:
+        return value == code.number;
+    case opcode::ne:
+        return value != code.number;
+    case opcode::lt:
+        return value < code.number;
+    case opcode::le:
+        return value <= code.number;
+    case opcode::gt:
+        return value > code.number;
+    case opcode::ge:
+        return value >= code.number;
+    case opcode::mask:
+        return value & code.number;
+    default:
+        return false;
+    }
+}
+
+bool event_filter::match(event_fields &fields) const {
+    bool stack[FILTER_CODE_MAX + 1];
+    size_t top = 0;
+    for (const instruction &code : code_) {
+        switch (code.op) {
+        case opcode::logical_not:
+            stack[top - 1] = !stack[top - 1];
+            break;
+        case opcode::logical_and:
+            --top;
+            stack[top - 1] = stack[top - 1] && stack[top];
+            break;
+        case opcode::logical_or:
+            --top;
+            stack[top - 1] = stack[top - 1] || stack[top];
+            break;
+        default:
+            stack[top++] = compare(code, fields);
+            break;
+        }
+    }
+    return top && stack[top - 1];
+}
+
+const std::string &event_filter::expression() const {
+    return expression_;
+}
+
+}; // namespace ipc
+
+}; // namespace hackernel
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#ifndef IPC_FILTER_H
+#define IPC_FILTER_H
+
+#include "hackernel/broadcaster.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace hackernel {
+
+namespace ipc {
+
+static const size_t FILTER_LENGTH_MAX = 1024;
+// 单个过滤条件编译后的指令数量上限,同时限制了求值时栈的深度
+static const size_t FILTER_CODE_MAX = 64;
+
+// 事件顶层字段的原始文本.首次查找时扫描一次 payload, 由同一事件的所有订阅者共享
+class event_fields {
+public:
+    explicit event_fields(const message_ptr &msg);
+    // 字段不存在时返回 false
+    bool find(std::string_view key, std::string_view &value);
+
+private:
+    const message_ptr &msg_;
+    bool scanned_ = false;
+    std::vector<std::pair<std::string, std::string_view>> fields_;
+};
+
+// 订阅时指定的事件过滤条件,编译为后缀表达式形式的指令序列,推送时按顺序求值.
+// 支持的比较有 == != < <= > >= & ^= *=, 可以用 && || ! 和括号组合,例如
+// name ^= "/etc/" && perm & 15.字段不存在或类型不符时比较结果为假
+class event_filter {
+    enum class opcode : uint8_t {
+        eq,
+        ne,
+        lt,
+        le,
+        gt,
+        ge,
+        // 与字面量按位与的结果不为 0
+        mask,
+        // 字符串以字面量开头
+        prefix,
+        // 字符串包含字面量
+        contains,
+        logical_not,
+        logical_and,
+        logical_or,
+    };
+
+    struct instruction {
+        opcode op;
+        bool is_string = false;
+        uint32_t field = 0;
+        int64_t number = 0;
+        std::string text;
+    };
+
+public:
+    // 语法错误或超出长度限制时返回 -EINVAL
+    static int compile(std::string_view expression, std::shared_ptr<const event_filter> &filter);
+    // 合并同一客户端多个订阅的过滤条件,任意一个满足即推送
+    static std::shared_ptr<const event_filter> any_of(const std::vector<std::shared_ptr<const event_filter>> &filters);
+
+    bool match(event_fields &fields) const;
+    const std::string &expression() const;
+
+private:
+    class parser;
+
+    bool compare(const instruction &code, event_fields &fields) const;
+    uint32_t intern(const std::string &field);
+
+private:
+    std::string expression_;
+    std::vector<std::string> fields_;
+    std::vector<instruction> code_;
+};
+
+}; // namespace ipc
+
+}; // namespace hackernel
+
+#endif
@@ -10,18 +10,22 @@ namespace hackernel {
 
 using namespace ipc;
 
-bool handle_user_test_echo_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::test::echo")
-        return false;
-
-    ipc_server::global().send_msg_to_client(doc);
+bool handle_user_test_echo_msg(const message_ptr &msg) {
+    ipc_server::global().send_msg_to_client(msg);
     return true;
 }
 
-static int UserMsgSubCheck(const nlohmann::json &data) {
+static int UserMsgSubCheck(const nlohmann::json &data, overflow_action &action) {
     if (!data["section"].is_string())
         goto errout;
+    if (data.contains("filter") && !data["filter"].is_string())
+        goto errout;
+    if (!data.contains("overflow"))
+        return 0;
+    if (!data["overflow"].is_string())
+        goto errout;
+    if (parse_overflow_action(data["overflow"].get_ref<const std::string &>(), action))
+        goto errout;
 
     return 0;
 
@@ -30,21 +34,89 @@ errout:
     return -EINVAL;
 }
 
-bool handle_user_sub_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::msg::sub")
-        return false;
+static int parse_aggregate(const nlohmann::json &data, std::shared_ptr<aggregator> &aggregate) {
+    const nlohmann::json &keys = data["keys"];
+    if (!keys.is_array() || keys.empty() || keys.size() > AGGREGATE_KEYS_MAX)
+        return -EINVAL;
+
+    aggregate = std::make_shared<aggregator>();
+    for (const nlohmann::json &key : keys) {
+        if (!key.is_string())
+            return -EINVAL;
+        aggregate->keys.push_back(key);
+    }
+
+    aggregate->interval = std::chrono::milliseconds(1000);
+    if (data.contains("interval")) {
+        if (!data["interval"].is_number_unsigned())
+            return -EINVAL;
+        aggregate->interval = std::chrono::milliseconds(data["interval"].get<uint64_t>());
+    }
+    if (aggregate->interval < AGGREGATE_INTERVAL_MIN || aggregate->interval > AGGREGATE_INTERVAL_MAX)
+        return -EINVAL;
+    return 0;
+}
+
+// 过滤条件,抽样和聚合都是可选的,抽样和聚合不能同时使用.都没有指定时 route 为空
+static int parse_delivery(const nlohmann::json &data, std::shared_ptr<delivery> &route) {
+    if (!data.contains("filter") && !data.contains("sample") && !data.contains("aggregate"))
+        return 0;
+
+    route = std::make_shared<delivery>();
+    if (data.contains("filter") && event_filter::compile(data["filter"].get_ref<const std::string &>(), route->filter))
+        return -EINVAL;
+    if (data.contains("sample")) {
+        if (!data["sample"].is_number_unsigned() || data["sample"] == 0 || data["sample"] > UINT32_MAX)
+            return -EINVAL;
+        route->sample = data["sample"];
+    }
+    if (data.contains("aggregate")) {
+        if (!data["aggregate"].is_object() || route->sample > 1)
+            return -EINVAL;
+        if (parse_aggregate(data["aggregate"], route->aggregate))
+            return -EINVAL;
+    }
+    return 0;
+}
 
-    user_conn conn;
-    if (ipc_server::global().clients.get(doc["session"], conn))
+// 从指定编号开始补发,不指定时只推送之后的事件.epoch 可选,用于判断服务是否重启过
+static int parse_resume(const nlohmann::json &data, replay_cursor &resume) {
+    if (data.contains("epoch")) {
+        if (!data["epoch"].is_number_unsigned() || data["epoch"] > UINT32_MAX)
+            return -EINVAL;
+        resume.epoch = data["epoch"];
+    }
+    if (!data.contains("resume"))
+        return 0;
+    if (!data["resume"].is_number_unsigned() || data["resume"] == 0)
+        return -EINVAL;
+    resume.seq = data["resume"];
+    return 0;
+}
+
+bool handle_user_sub_msg(const message_ptr &msg) {
+    nlohmann::json doc = msg->doc();
+    conn_cache::handle conn;
+    if (ipc_server::global().find_client(doc["session"], conn))
         return false;
 
     nlohmann::json &data = doc["data"];
-    if (UserMsgSubCheck(data))
+    overflow_action action = overflow_action::drop;
+    if (UserMsgSubCheck(data, action))
         return false;
     const std::string &section = data["section"];
 
-    data["code"] = ipc_server::global().handle_msg_sub(section, conn);
+    // 推送方式有误时回复 -EINVAL, 便于客户端定位
+    std::shared_ptr<delivery> route;
+    replay_cursor resume, current;
+    if (parse_delivery(data, route) || parse_resume(data, resume))
+        data["code"] = -EINVAL;
+    else
+        data["code"] = ipc_server::global().handle_msg_sub(section, *conn, action, route, resume, current);
+    if (current.epoch) {
+        data["epoch"] = current.epoch;
+        data["seq"] = current.seq;
+    }
     ipc_server::global().send_msg_to_client(doc);
     return true;
 }
@@ -62,13 +134,10 @@ errout:
     return -EINVAL;
 }
 
-bool handle_user_unsub_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::msg::unsub")
-        return false;
-
-    user_conn conn;
-    if (ipc_server::global().clients.get(doc["session"], conn))
+bool handle_user_unsub_msg(const message_ptr &msg) {
+    nlohmann::json doc = msg->doc();
+    conn_cache::handle conn;
+    if (ipc_server::global().find_client(doc["session"], conn))
         return false;
 
     nlohmann::json &data = doc["data"];
@@ -76,16 +145,84 @@ bool handle_user_unsub_msg(const std::string &msg) {
         return false;
     const std::string &section = data["section"];
 
-    data["code"] = ipc_server::global().handle_msg_unsub(section, conn);
+    data["code"] = ipc_server::global().handle_msg_unsub(section, *conn);
     ipc_server::global().send_msg_to_client(doc);
     return true;
 }
 
-bool handle_user_ctrl_exit_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::ctrl::exit")
+static int check_user_msg_shm_data(const nlohmann::json &data, size_t &size) {
+    if (!data.contains("size"))
+        return 0;
+    if (!data["size"].is_number_unsigned())
+        goto errout;
+    size = data["size"];
+    return 0;
+
+errout:
+    WARN("invalid argument=[%s]", json::dump(data).data());
+    return -EINVAL;
+}
+
+// 成功时响应附带共享内存和 eventfd 两个描述符
+bool handle_user_shm_msg(const message_ptr &msg) {
+    nlohmann::json doc = msg->doc();
+    conn_cache::handle conn;
+    if (ipc_server::global().find_client(doc["session"], conn))
+        return false;
+
+    nlohmann::json &data = doc["data"];
+    size_t size = SHM_RING_CAPACITY_DEFAULT;
+    std::shared_ptr<shm_channel> channel;
+    if (check_user_msg_shm_data(data, size))
+        data["code"] = -EINVAL;
+    else
+        data["code"] = ipc_server::global().open_channel(*conn, size, channel);
+
+    if (!channel) {
+        ipc_server::global().send_msg_to_client(doc);
+        return true;
+    }
+
+    data["capacity"] = channel->capacity();
+    ipc_server::global().send_msg_to_client(doc, {channel->memfd(), channel->eventfd()});
+    return true;
+}
+
+static int check_user_batch_data(const nlohmann::json &data) {
+    if (!data.contains("commands"))
+        goto errout;
+    if (!data["commands"].is_array())
+        goto errout;
+    if (data["commands"].empty() || data["commands"].size() > IPC_BATCH_MAX)
+        goto errout;
+    return 0;
+
+errout:
+    WARN("invalid batch, size=[%zu]", data.contains("commands") ? data["commands"].size() : 0);
+    return -EINVAL;
+}
+
+// 回复在全部命令响应后发送,无法处理时立即回复错误码
+bool handle_user_batch_msg(const message_ptr &msg) {
+    nlohmann::json doc = msg->doc();
+    conn_cache::handle conn;
+    if (ipc_server::global().find_client(doc["session"], conn))
         return false;
 
+    nlohmann::json &data = doc["data"];
+    int code = check_user_batch_data(data);
+    if (!code)
+        code = ipc_server::global().handle_msg_batch(doc["session"], conn, data["commands"]);
+    if (!code)
+        return true;
+
+    data["code"] = code;
+    data.erase("commands");
+    ipc_server::global().send_msg_to_client(doc);
+    return true;
+}
+
+bool handle_user_ctrl_exit_msg(const message_ptr &msg) {
     shutdown_service(HACKERNEL_SUCCESS);
     return true;
 }
@@ -102,11 +239,8 @@ errout:
     return -EINVAL;
 }
 
-bool handle_user_ctrl_token_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "user::ctrl::token")
-        return false;
-
+bool handle_user_ctrl_token_msg(const message_ptr &msg) {
+    nlohmann::json doc = msg->doc();
     nlohmann::json &data = doc["data"];
     if (check_user_ctrl_token_data(data))
         return false;
@@ -117,146 +251,125 @@ bool handle_user_ctrl_token_msg(const std::string &msg) {
     return true;
 }
 
-bool handle_kernel_process_report_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::proc::report")
-        return false;
+bool handle_user_ctrl_stats_msg(const message_ptr &msg) {
+    nlohmann::json doc = msg->doc();
+    nlohmann::json &data = doc["data"];
 
-    ipc_server::global().broadcast_msg_to_subscriber(doc);
+    data["audience"] = broadcaster::global().stats();
+    data["subscription"] = ipc_server::global().stats();
+    data["code"] = 0;
+    ipc_server::global().send_msg_to_client(doc);
     return true;
 }
 
-bool handle_kernel_process_enable_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::proc::enable")
-        return false;
+static int check_user_ctrl_format_data(const nlohmann::json &data, wire_format &format) {
+    if (!data.contains("format"))
+        goto errout;
+    if (!data["format"].is_string())
+        goto errout;
+    if (json::parse_format(data["format"], format))
+        goto errout;
+    return 0;
 
-    ipc_server::global().send_msg_to_client(doc);
-    return true;
+errout:
+    WARN("invalid argument=[%s]", json::dump(data).data());
+    return -EINVAL;
 }
 
-bool handle_kernel_process_disable_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::proc::disable")
+// 响应仍使用切换前的编码格式,之后的响应和订阅事件使用新格式
+bool handle_user_ctrl_format_msg(const message_ptr &msg) {
+    nlohmann::json doc = msg->doc();
+    conn_cache::handle conn;
+    if (ipc_server::global().find_client(doc["session"], conn))
         return false;
 
+    nlohmann::json &data = doc["data"];
+    wire_format format;
+    if (check_user_ctrl_format_data(data, format))
+        data["code"] = -EINVAL;
+    else
+        data["code"] = ipc_server::global().update_format(*conn, format);
+
     ipc_server::global().send_msg_to_client(doc);
     return true;
 }
 
-bool handle_kernel_file_report_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::file::report")
-        return false;
-
-    ipc_server::global().broadcast_msg_to_subscriber(doc);
+bool handle_kernel_process_report_msg(const message_ptr &msg) {
+    ipc_server::global().broadcast_msg_to_subscriber(msg);
     return true;
 }
 
-bool handle_kernel_file_set_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::file::set")
-        return false;
-
-    ipc_server::global().send_msg_to_client(doc);
+bool handle_kernel_process_enable_msg(const message_ptr &msg) {
+    ipc_server::global().send_msg_to_client(msg->doc());
     return true;
 }
-bool handle_kernel_file_enable_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::file::enable")
-        return false;
 
-    ipc_server::global().send_msg_to_client(doc);
+bool handle_kernel_process_disable_msg(const message_ptr &msg) {
+    ipc_server::global().send_msg_to_client(msg->doc());
     return true;
 }
 
-bool handle_kernel_file_clear_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::file::clear")
-        return false;
-
-    ipc_server::global().send_msg_to_client(doc);
+bool handle_kernel_file_report_msg(const message_ptr &msg) {
+    ipc_server::global().broadcast_msg_to_subscriber(msg);
     return true;
 }
 
-bool handle_kernel_file_disable_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::file::disable")
-        return false;
-
-    ipc_server::global().send_msg_to_client(doc);
+bool handle_kernel_file_set_msg(const message_ptr &msg) {
+    ipc_server::global().send_msg_to_client(msg->doc());
     return true;
 }
-
-bool handle_kernel_net_report_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::net::report")
-        return false;
-
-    ipc_server::global().broadcast_msg_to_subscriber(doc);
+bool handle_kernel_file_enable_msg(const message_ptr &msg) {
+    ipc_server::global().send_msg_to_client(msg->doc());
     return true;
 }
 
-bool handle_kernel_net_insert_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::net::insert")
-        return false;
-
-    ipc_server::global().send_msg_to_client(doc);
+bool handle_kernel_file_clear_msg(const message_ptr &msg) {
+    ipc_server::global().send_msg_to_client(msg->doc());
     return true;
 }
 
-bool handle_kernel_net_delete_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::net::delete")
-        return false;
-
-    ipc_server::global().send_msg_to_client(doc);
+bool handle_kernel_file_disable_msg(const message_ptr &msg) {
+    ipc_server::global().send_msg_to_client(msg->doc());
     return true;
 }
 
-bool handle_kernel_net_enable_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::net::enable")
-        return false;
-
-    ipc_server::global().send_msg_to_client(doc);
+bool handle_kernel_net_report_msg(const message_ptr &msg) {
+    ipc_server::global().broadcast_msg_to_subscriber(msg);
     return true;
 }
 
-bool handle_kernel_net_disable_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::net::disable")
-        return false;
-
-    ipc_server::global().send_msg_to_client(doc);
+bool handle_kernel_net_insert_msg(const message_ptr &msg) {
+    ipc_server::global().send_msg_to_client(msg->doc());
     return true;
 }
 
-bool handle_kernel_net_clear_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "kernel::net::clear")
-        return false;
+bool handle_kernel_net_delete_msg(const message_ptr &msg) {
+    ipc_server::global().send_msg_to_client(msg->doc());
+    return true;
+}
 
-    ipc_server::global().send_msg_to_client(doc);
+bool handle_kernel_net_enable_msg(const message_ptr &msg) {
+    ipc_server::global().send_msg_to_client(msg->doc());
     return true;
 }
 
-bool handle_audit_process_report_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "audit::proc::report")
-        return false;
+bool handle_kernel_net_disable_msg(const message_ptr &msg) {
+    ipc_server::global().send_msg_to_client(msg->doc());
+    return true;
+}
 
-    ipc_server::global().broadcast_msg_to_subscriber(doc);
+bool handle_kernel_net_clear_msg(const message_ptr &msg) {
+    ipc_server::global().send_msg_to_client(msg->doc());
     return true;
 }
 
-bool handle_osinfo_report_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (doc["type"] != "osinfo::report")
-        return false;
+bool handle_audit_process_report_msg(const message_ptr &msg) {
+    ipc_server::global().broadcast_msg_to_subscriber(msg);
+    return true;
+}
 
-    ipc_server::global().broadcast_msg_to_subscriber(doc);
+bool handle_osinfo_report_msg(const message_ptr &msg) {
+    ipc_server::global().broadcast_msg_to_subscriber(msg);
     return true;
 }
 
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#include "ipc/replay.h"
+#include <algorithm>
+#include <random>
+
+namespace hackernel {
+
+namespace ipc {
+
+// epoch 不为 0, 客户端可以用 0 表示未知
+replay_ring::replay_ring(size_t capacity) : events_(std::max<size_t>(capacity, 1)) {
+    std::random_device random;
+    do {
+        epoch_ = random();
+    } while (!epoch_);
+}
+
+message_ptr replay_ring::push(const message_ptr &msg, uint64_t &seq) {
+    seq = ++last_;
+    message_ptr evicted = msg;
+    events_[seq % events_.size()].swap(evicted);
+    return evicted;
+}
+
+uint64_t replay_ring::collect(uint64_t from, std::vector<replay_entry> &events) const {
+    uint64_t oldest = last_ < events_.size() ? 1 : last_ - events_.size() + 1;
+    for (uint64_t seq = std::max(from, oldest); seq <= last_; ++seq)
+        events.push_back({seq, events_[seq % events_.size()]});
+    return oldest;
+}
+
+uint64_t replay_ring::last() const {
+    return last_;
+}
+
+uint32_t replay_ring::epoch() const {
+    return epoch_;
+}
+
+// 直接拼接文本,不需要解析事件.编码为其他格式时由新事件重新解析
+message_ptr replay_ring::stamp(const message_ptr &msg, uint32_t epoch, uint64_t seq) {
+    std::string_view payload = msg->payload();
+    if (payload.size() < 2 || payload.front() != '{')
+        return msg;
+
+    std::string text = "{\"epoch\":" + std::to_string(epoch) + ",\"seq\":" + std::to_string(seq);
+    if (payload[1] != '}')
+        text.push_back(',');
+    text.append(payload.substr(1));
+    return message::make(msg->session(), msg->type(), text);
+}
+
+}; // namespace ipc
+
+}; // namespace hackernel
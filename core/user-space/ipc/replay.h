@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#ifndef IPC_REPLAY_H
+#define IPC_REPLAY_H
+
+#include "hackernel/broadcaster.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace hackernel {
+
+namespace ipc {
+
+// 保留的事件数量,为订阅者发送队列容量的一半,补发期间队列还能容纳新推送的事件
+static const size_t REPLAY_RING_CAPACITY = 2048;
+
+// 事件在某次运行中的位置.epoch 在服务启动时随机生成,编号从 1 开始
+struct replay_cursor {
+    uint32_t epoch = 0;
+    uint64_t seq = 0;
+};
+
+struct replay_entry {
+    uint64_t seq = 0;
+    message_ptr msg;
+};
+
+// 推送给订阅者的事件按顺序编号,并保留最近的一部分,订阅时可以从指定编号补发.
+// 只保存原始事件,推送或补发时才生成带编号的副本.不是线程安全的,由调用者加锁
+class replay_ring {
+public:
+    explicit replay_ring(size_t capacity = REPLAY_RING_CAPACITY);
+
+    // 分配编号并保留事件,返回被覆盖的事件,由调用者在锁外释放
+    message_ptr push(const message_ptr &msg, uint64_t &seq);
+    // 取出编号不小于 from 的事件,返回仍然保留的最小编号,小于它的事件已经被覆盖
+    uint64_t collect(uint64_t from, std::vector<replay_entry> &events) const;
+    // 最近一个事件的编号,还没有事件时为 0
+    uint64_t last() const;
+    uint32_t epoch() const;
+
+    // 在事件内容的开头加入 "epoch" 和 "seq" 字段.内容不是 Json 对象时原样返回
+    static message_ptr stamp(const message_ptr &msg, uint32_t epoch, uint64_t seq);
+
+private:
+    std::vector<message_ptr> events_;
+    uint64_t last_ = 0;
+    uint32_t epoch_;
+};
+
+}; // namespace ipc
+
+}; // namespace hackernel
+
+#endif
@@ -3,11 +3,17 @@
 #include "hackernel/broadcaster.h"
 #include "hackernel/ipc.h"
 #include "hackernel/thread.h"
+#include "hackernel/timer.h"
 #include "ipc/handler.h"
 #include <algorithm>
+#include <cstddef>
 #include <errno.h>
 #include <functional>
 #include <nlohmann/json.hpp>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
 #include <thread>
 #include <unistd.h>
 
@@ -44,6 +50,28 @@ bool token::is_enabled() {
     return !tokens_.empty();
 }
 
+// 抽象命名空间的地址以 '\0' 开头,需要按长度截取
+static std::string_view peer_name(const user_conn &conn) {
+    size_t len = std::min<size_t>(conn.len - offsetof(struct sockaddr_un, sun_path), sizeof(conn.peer.sun_path));
+    if (len && conn.peer.sun_path[0])
+        len = strnlen(conn.peer.sun_path, len);
+    return std::string_view(conn.peer.sun_path, len);
+}
+
+// 用户请求按发起请求的客户端分配工作线程,同一客户端的请求按接收顺序处理.
+// 内核响应带有请求的 session, 在响应前 session 一直可以找到客户端,与请求分配到同一个工作线程.
+// 系统事件按类型分配,同一类型的事件有序
+static size_t ipc_message_key(const message_ptr &msg) {
+    session session = msg->session();
+    if (session == SYSTEM_SESSION)
+        return std::hash<std::string_view>()(msg->type());
+
+    conn_cache::handle conn;
+    if (ipc_server::global().find_client(session, conn))
+        return std::hash<hackernel::session>()(session);
+    return std::hash<std::string_view>()(peer_name(*conn));
+}
+
 ipc_server &ipc_server::global() {
     static ipc_server instance;
     return instance;
@@ -51,42 +79,62 @@ ipc_server &ipc_server::global() {
 
 int ipc_server::init() {
     clients.set_capacity(1024);
+    clients.set_ttl(IPC_SESSION_TTL);
+    formats_.set_capacity(IPC_FORMAT_MAX);
+    formats_.set_ttl(IPC_FORMAT_TTL);
 
-    audience_ = std::make_shared<audience>();
-
-    audience_->add_message_handler(handle_osinfo_report_msg);
-    audience_->add_message_handler(handle_kernel_process_report_msg);
-    audience_->add_message_handler(handle_audit_process_report_msg);
-    audience_->add_message_handler(handle_kernel_file_report_msg);
-    audience_->add_message_handler(handle_kernel_net_report_msg);
-    audience_->add_message_handler(handle_kernel_process_enable_msg);
-    audience_->add_message_handler(handle_kernel_process_disable_msg);
-    audience_->add_message_handler(handle_kernel_file_set_msg);
-    audience_->add_message_handler(handle_kernel_file_enable_msg);
-    audience_->add_message_handler(handle_kernel_file_clear_msg);
-    audience_->add_message_handler(handle_kernel_file_disable_msg);
-    audience_->add_message_handler(handle_kernel_net_insert_msg);
-    audience_->add_message_handler(handle_kernel_net_delete_msg);
-    audience_->add_message_handler(handle_kernel_net_enable_msg);
-    audience_->add_message_handler(handle_kernel_net_disable_msg);
-    audience_->add_message_handler(handle_kernel_net_clear_msg);
-    audience_->add_message_handler(handle_user_sub_msg);
-    audience_->add_message_handler(handle_user_unsub_msg);
-    audience_->add_message_handler(handle_user_ctrl_exit_msg);
-    audience_->add_message_handler(handle_user_ctrl_token_msg);
-    audience_->add_message_handler(handle_user_test_echo_msg);
-
-    broadcaster::global().add_audience(audience_);
+    flush_event_ = eventfd(0, EFD_NONBLOCK);
+    if (flush_event_ == -1) {
+        ERR("eventfd create failed");
+        return -EPERM;
+    }
+
+    size_t workers = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, IPC_WORKER_MAX);
+    audience_ = std::make_shared<audience>("ipc", AUDIENCE_QUEUE_CAPACITY, overflow_policy::drop_expendable, workers);
+    audience_->set_message_key(ipc_message_key);
+
+    audience_->add_message_handler("osinfo::report", handle_osinfo_report_msg);
+    audience_->add_message_handler("kernel::proc::report", handle_kernel_process_report_msg);
+    audience_->add_message_handler("audit::proc::report", handle_audit_process_report_msg);
+    audience_->add_message_handler("kernel::file::report", handle_kernel_file_report_msg);
+    audience_->add_message_handler("kernel::net::report", handle_kernel_net_report_msg);
+    audience_->add_message_handler("kernel::proc::enable", handle_kernel_process_enable_msg);
+    audience_->add_message_handler("kernel::proc::disable", handle_kernel_process_disable_msg);
+    audience_->add_message_handler("kernel::file::set", handle_kernel_file_set_msg);
+    audience_->add_message_handler("kernel::file::enable", handle_kernel_file_enable_msg);
+    audience_->add_message_handler("kernel::file::clear", handle_kernel_file_clear_msg);
+    audience_->add_message_handler("kernel::file::disable", handle_kernel_file_disable_msg);
+    audience_->add_message_handler("kernel::net::insert", handle_kernel_net_insert_msg);
+    audience_->add_message_handler("kernel::net::delete", handle_kernel_net_delete_msg);
+    audience_->add_message_handler("kernel::net::enable", handle_kernel_net_enable_msg);
+    audience_->add_message_handler("kernel::net::disable", handle_kernel_net_disable_msg);
+    audience_->add_message_handler("kernel::net::clear", handle_kernel_net_clear_msg);
+    audience_->add_message_handler("user::msg::sub", handle_user_sub_msg);
+    audience_->add_message_handler("user::msg::unsub", handle_user_unsub_msg);
+    audience_->add_message_handler("user::msg::shm", handle_user_shm_msg);
+    audience_->add_message_handler("user::batch", handle_user_batch_msg);
+    audience_->add_message_handler("user::ctrl::exit", handle_user_ctrl_exit_msg);
+    audience_->add_message_handler("user::ctrl::token", handle_user_ctrl_token_msg);
+    audience_->add_message_handler("user::ctrl::stats", handle_user_ctrl_stats_msg);
+    audience_->add_message_handler("user::ctrl::format", handle_user_ctrl_format_msg);
+    audience_->add_message_handler("user::test::echo", handle_user_test_echo_msg);
+
+    message_topics topics = {"kernel::", "audit::", "osinfo::", "user::msg::", "user::ctrl::", "user::test::",
+                             "user::batch"};
+    broadcaster::global().add_audience(audience_, topics);
     return 0;
 }
 
 int ipc_server::start() {
-    thread_manager::global().create_thread([&]() {
-        update_thread_name("audience");
-        DBG("audience enter");
-        audience_->start_consuming_message();
-        DBG("audience exit");
-    });
+    for (size_t worker = 0; worker < audience_->worker_count(); ++worker) {
+        thread_manager::global().create_thread([&, worker]() {
+            std::string name = "audience-" + std::to_string(worker);
+            update_thread_name(name.data());
+            DBG("audience enter, worker=[%zu]", worker);
+            audience_->start_consuming_message(worker);
+            DBG("audience exit, worker=[%zu]", worker);
+        });
+    }
 
     thread_manager::global().create_thread([&]() {
         update_thread_name("socket");
@@ -94,6 +142,20 @@ int ipc_server::start() {
         start_unix_domain_socket();
         DBG("socket exit");
     });
+
+    thread_manager::global().create_thread([&]() {
+        update_thread_name("flush");
+        DBG("flush enter");
+        start_flush();
+        DBG("flush exit");
+    });
+
+    thread_manager::global().create_thread([&]() {
+        update_thread_name("stream");
+        DBG("stream enter");
+        start_stream_socket();
+        DBG("stream exit");
+    });
     return 0;
 }
 
@@ -103,109 +165,1030 @@ int ipc_server::stop() {
     if (socket_ && shutdown(socket_, SHUT_RDWR))
         DBG("close socket failed");
 
+    if (stream_socket_ && shutdown(stream_socket_, SHUT_RDWR))
+        DBG("close stream socket failed");
+
+    flushing_ = false;
+    uint64_t value = 1;
+    if (flush_event_ != -1 && write(flush_event_, &value, sizeof(value)) == -1)
+        DBG("wake flush thread failed");
+
     if (audience_)
         audience_->stop_consuming_message();
     return 0;
 }
 
-int ipc_server::send_msg_to_client(const nlohmann::json &doc) {
-    user_conn conn;
+stream_conn::stream_conn(int fd) : fd(fd) {}
+
+stream_conn::~stream_conn() {
+    close(fd);
+}
+
+// 原样回复客户端的请求,请求在接收时已经补充了 extra 字段,可以直接使用消息缓存的 payload
+int ipc_server::send_msg_to_client(const message_ptr &msg) {
+    if (!complete_batch_item(msg->session(), 0))
+        return 0;
+
+    conn_cache::handle conn;
+    if (find_client(msg->session(), conn))
+        return -ESRCH;
+
+    release_session(*conn, msg->session());
+    return send_msg_to_client(*conn, msg->payload(conn->format));
+}
+
+// 用户请求已经带有 extra 字段,内核产生的响应需要补充后再序列化
+int ipc_server::send_msg_to_client(const nlohmann::json &doc, const std::vector<int> &fds) {
+    conn_cache::handle conn;
     session session = doc["session"];
+    auto code = doc["data"].find("code");
+    if (!complete_batch_item(session, code != doc["data"].end() && code->is_number_integer() ? code->get<int>() : 0))
+        return 0;
 
-    if (ipc_server::global().clients.get(session, conn))
+    if (find_client(session, conn))
         return -ESRCH;
 
-    nlohmann::json data = doc["data"];
-    data["extra"] = conn.extra;
+    release_session(*conn, session);
+    const nlohmann::json &data = doc["data"];
+    if (data.contains("extra"))
+        return send_msg_to_client(*conn, json::encode(data, conn->format), fds);
+
+    nlohmann::json reply = data;
+    reply["extra"] = conn->extra;
+    return send_msg_to_client(*conn, json::encode(reply, conn->format), fds);
+}
+
+// 二进制编码的消息不适合直接打印到日志
+static const char *printable(const user_conn &conn, std::string_view msg) {
+    return conn.format == wire_format::json ? msg.data() : "<binary>";
+}
+
+// 面向连接的客户端优先在 epoll 线程维护的表中查找,其余的在缓存中查找.
+// 批量请求中的命令使用所属请求的客户端
+int ipc_server::find_client(session session, conn_cache::handle &conn) {
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        auto it = batch_items_.find(session);
+        if (it != batch_items_.end()) {
+            conn = it->second.first->conn;
+            return 0;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex_);
+        auto it = streams_.find(session);
+        if (it != streams_.end()) {
+            conn = it->second;
+            return 0;
+        }
+    }
+    return clients.get(session, conn);
+}
+
+// 每个请求只响应一次,响应后连接上的 session 不再需要保留
+void ipc_server::release_session(const user_conn &conn, session session) {
+    if (!conn.stream)
+        return;
 
-    return send_msg_to_client(conn, json::dump(data));
+    std::lock_guard<std::mutex> lock(stream_mutex_);
+    conn.stream->sessions.erase(session);
+    streams_.erase(session);
 }
 
-int ipc_server::send_msg_to_client(user_conn conn, const std::string &msg) {
+// 没有响应的请求(如 handler 拒绝或没有 handler 的类型)与数据报客户端一样过期释放.
+// 已经响应的 session 在到达队首时一并移除,调用方持有 stream_mutex_
+void ipc_server::expire_sessions(stream_conn &stream, std::chrono::steady_clock::time_point now) {
+    while (!stream.expiry.empty()) {
+        auto [expire, session] = stream.expiry.front();
+        if (expire > now && stream.sessions.contains(session))
+            break;
+        if (stream.sessions.erase(session))
+            streams_.erase(session);
+        stream.expiry.pop_front();
+    }
+}
+
+// 描述符作为辅助数据附在消息上,客户端收到消息的同时获得描述符
+static int send_with_fds(int fd, std::string_view msg, const std::vector<int> &fds) {
+    struct iovec iov = {.iov_base = (void *)msg.data(), .iov_len = msg.size()};
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+    struct msghdr hdr = {};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control.data();
+    hdr.msg_controllen = control.size();
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    return sendmsg(fd, &hdr, MSG_NOSIGNAL) == -1 ? -1 : 0;
+}
+
+int ipc_server::send_msg_to_client(const user_conn &conn, std::string_view msg, const std::vector<int> &fds) {
     socklen_t len;
     struct sockaddr *peer;
-    peer = (struct sockaddr *)conn.peer.get();
+    peer = (struct sockaddr *)&conn.peer;
     len = conn.len;
+    if (!fds.empty()) {
+        if (!conn.stream || send_with_fds(conn.stream->fd, msg, fds)) {
+            WARN("send fds error, msg=[%s]", printable(conn, msg));
+            return -EPERM;
+        }
+        return 0;
+    }
+    if (conn.stream) {
+        if (send(conn.stream->fd, msg.data(), msg.size(), MSG_NOSIGNAL) == -1) {
+            WARN("send error, fd=[%d], msg=[%s]", conn.stream->fd, printable(conn, msg));
+            return -EPERM;
+        }
+        return 0;
+    }
     if (sendto(socket_, msg.data(), msg.size(), 0, peer, len) == -1) {
-        WARN("send error, peer=[%s], msg=[%s]", ((struct sockaddr_un *)peer)->sun_path, msg.data());
+        WARN("send error, peer=[%s], msg=[%s]", ((struct sockaddr_un *)peer)->sun_path, printable(conn, msg));
         return -EPERM;
     }
     return 0;
 }
 
-int ipc_server::handle_msg_sub(const std::string &section, const user_conn &user) {
-    std::lock_guard<std::mutex> lock(sub_mutex_);
-    auto cmp = [&](const user_conn_counter &item) {
-        return strcmp(user.peer->sun_path, item.conn.peer->sun_path) == 0;
+// 先登记全部命令再分发,避免响应早于登记.格式不正确的命令不分发,直接记为 -EINVAL.
+// 尚未响应的命令过多时返回 -EBUSY, 由调用方按普通请求回复
+int ipc_server::handle_msg_batch(session session, const conn_cache::handle &conn, const nlohmann::json &commands) {
+    auto batch = std::make_shared<batch_state>();
+    batch->id = session;
+    batch->conn = conn;
+    batch->sessions.resize(commands.size(), SYSTEM_SESSION);
+    batch->codes.resize(commands.size(), -ETIMEDOUT);
+
+    auto valid = [](const nlohmann::json &command) {
+        return command.is_object() && command.contains("type") && command["type"].is_string() &&
+               command["type"] != "user::batch";
     };
-    auto it = std::find_if(sub_[section].begin(), sub_[section].end(), cmp);
-    if (it == sub_[section].end()) {
-        sub_[section].emplace_back(user, 1);
-    } else
-        ++it->counter;
+    size_t count = std::count_if(commands.begin(), commands.end(), valid);
+    // 与接收线程分配的 session 来自同一个计数器,整批一次取得,不会与其他请求重复
+    uint32_t next = count ? generate_user_sessions(count) : SYSTEM_SESSION;
+
+    std::vector<message_ptr> messages;
+    messages.reserve(count);
+    for (size_t i = 0; i < commands.size(); ++i) {
+        const nlohmann::json &command = commands[i];
+        if (!valid(command)) {
+            batch->codes[i] = -EINVAL;
+            continue;
+        }
+
+        batch->sessions[i] = next++;
+        nlohmann::json doc;
+        doc["session"] = batch->sessions[i];
+        doc["type"] = command["type"];
+        doc["data"] = command;
+        messages.push_back(message::make(std::move(doc)));
+    }
+    batch->pending = messages.size();
+    if (!batch->pending) {
+        release_session(*conn, session);
+        return reply_batch(*batch);
+    }
+
+    // 检查上限和登记在同一把锁内完成,并发的批量请求不会一起超出上限
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        if (batch_items_.size() + batch->pending > IPC_BATCH_PENDING_MAX)
+            return -EBUSY;
+        batches_[session] = batch;
+        for (size_t i = 0; i < commands.size(); ++i)
+            if (batch->sessions[i] != SYSTEM_SESSION)
+                batch_items_[batch->sessions[i]] = {batch, i};
+    }
+    release_session(*conn, session);
+
+    timer::event event;
+    event.time_point = std::chrono::system_clock::now() + IPC_BATCH_TIMEOUT;
+    event.func = [session]() { ipc_server::global().expire_batch(session); };
+    timer::timer::global().insert(event);
+
+    // 当前线程是 ipc 的工作线程,等待自己的队列出现空位会死锁,写不进队列的命令直接失败
+    std::vector<message_ptr> rejected;
+    broadcaster::global().offer(messages, rejected);
+    for (const message_ptr &message : rejected)
+        complete_batch_item(message->session(), -EBUSY);
+    return 0;
+}
+
+// 不属于批量请求时返回 -ESRCH, 由调用方按普通请求回复
+int ipc_server::complete_batch_item(session session, int code) {
+    std::shared_ptr<batch_state> batch;
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        auto it = batch_items_.find(session);
+        if (it == batch_items_.end())
+            return -ESRCH;
+
+        batch = it->second.first;
+        batch->codes[it->second.second] = code;
+        batch_items_.erase(it);
+        if (--batch->pending)
+            return 0;
+        batches_.erase(batch->id);
+    }
+    reply_batch(*batch);
+    return 0;
+}
+
+void ipc_server::expire_batch(session id) {
+    std::shared_ptr<batch_state> batch;
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        auto it = batches_.find(id);
+        if (it == batches_.end())
+            return;
+
+        batch = it->second;
+        batches_.erase(it);
+        for (session session : batch->sessions)
+            batch_items_.erase(session);
+    }
+    WARN("batch timeout, session=[%d] pending=[%zu]", id, batch->pending);
+    reply_batch(*batch);
+}
+
+int ipc_server::reply_batch(const batch_state &batch) {
+    nlohmann::json reply;
+    reply["type"] = "user::batch";
+    reply["code"] = 0;
+    reply["codes"] = batch.codes;
+    reply["failed"] = std::count_if(batch.codes.begin(), batch.codes.end(), [](int code) { return code; });
+    reply["extra"] = batch.conn->extra;
+    return send_msg_to_client(*batch.conn, json::encode(reply, batch.conn->format));
+}
+
+// reason 为 reset 时客户端的位置属于重启前的服务,为 lost 时 [begin, end] 范围内的事件已经被覆盖
+static message_ptr make_gap_msg(const std::string &section, const char *reason, uint32_t epoch, uint64_t begin = 0,
+                                uint64_t end = 0) {
+    nlohmann::json data;
+    data["type"] = "user::msg::gap";
+    data["section"] = section;
+    data["reason"] = reason;
+    data["epoch"] = epoch;
+    if (begin) {
+        data["begin"] = begin;
+        data["end"] = end;
+    }
+    return generate_system_broadcast_msg(data);
+}
+
+// 按订阅的主题和推送方式筛选补发的事件,只为需要补发的事件生成带编号的副本
+static void prepare_replay(const std::string &section, const std::shared_ptr<delivery> &route, uint32_t epoch,
+                           const std::vector<replay_entry> &entries, std::vector<message_ptr> &events) {
+    for (const replay_entry &entry : entries) {
+        if (!subscription_registry::match_topic(section, entry.msg->type()))
+            continue;
+        event_fields fields(entry.msg);
+        if (route && !route->accept(fields))
+            continue;
+        events.push_back(replay_ring::stamp(entry.msg, epoch, entry.seq));
+    }
+}
+
+// 补发分两步:先在锁内取出保留的事件,在锁外筛选并生成副本.
+// 订阅生效时再取出这期间新增的事件,与之前的一起写入发送队列,之后的事件由推送写入,二者不会重复或遗漏
+int ipc_server::handle_msg_sub(const std::string &section, const user_conn &user, overflow_action action,
+                               std::shared_ptr<delivery> route, const replay_cursor &resume, replay_cursor &current) {
+    std::shared_ptr<aggregator> aggregate = route ? route->aggregate : nullptr;
+    if (aggregate) {
+        aggregate->peer = peer_name(user);
+        aggregate->topic = section;
+    }
+
+    uint32_t epoch = replay_.epoch();
+    std::vector<message_ptr> notices, events;
+    std::vector<replay_entry> entries;
+    uint64_t next = 0;
+    if (resume.seq) {
+        uint64_t from, oldest;
+        {
+            std::lock_guard<std::mutex> lock(sub_mutex_);
+            bool reset = (resume.epoch && resume.epoch != epoch) || resume.seq > replay_.last() + 1;
+            if (reset)
+                notices.push_back(make_gap_msg(section, "reset", epoch));
+            from = reset ? 1 : resume.seq;
+            oldest = replay_.collect(from, entries);
+            next = replay_.last() + 1;
+        }
+        if (from < oldest)
+            notices.push_back(make_gap_msg(section, "lost", epoch, from, oldest - 1));
+        prepare_replay(section, route, epoch, entries, events);
+        entries.clear();
+    }
+
+    std::vector<subscriber> scheduled;
+    {
+        std::lock_guard<std::mutex> lock(sub_mutex_);
+        int error = sub_.subscribe(section, peer_name(user), user, action, route);
+        if (error)
+            return error;
+
+        current.epoch = epoch;
+        current.seq = replay_.last();
+        if (next) {
+            uint64_t oldest = replay_.collect(next, entries);
+            if (next < oldest)
+                notices.push_back(make_gap_msg(section, "lost", epoch, next, oldest - 1));
+            prepare_replay(section, route, epoch, entries, events);
+
+            subscriber target;
+            sub_.find(peer_name(user), target);
+            for (const message_ptr &msg : notices)
+                enqueue(target, msg, scheduled);
+            for (const message_ptr &msg : events)
+                enqueue(target, msg, scheduled);
+        }
+    }
+    schedule(scheduled);
+
+    if (aggregate)
+        schedule_aggregate(aggregate);
     return 0;
 }
 
 int ipc_server::handle_msg_unsub(const std::string &section, const user_conn &user) {
     std::lock_guard<std::mutex> lock(sub_mutex_);
-    auto cmp = [&](const user_conn_counter &item) {
-        return strcmp(user.peer->sun_path, item.conn.peer->sun_path) == 0;
-    };
-    auto it = std::find_if(sub_[section].begin(), sub_[section].end(), cmp);
-    if (it == sub_[section].end())
-        return -EPERM;
-    if (--it->counter <= 0) {
-        sub_[section].erase(it);
+    return sub_.unsubscribe(section, peer_name(user));
+}
+
+// 对端 socket 已关闭或文件已删除,之后的发送都不会成功
+static bool is_dead_peer(int error) {
+    return error == ECONNREFUSED || error == ENOENT || error == ENOTSOCK || error == EPIPE || error == ECONNRESET;
+}
+
+// 只把事件写入各个订阅者的发送队列,不在推送线程中发送.
+// 新加入发送列表的订阅者整批交给发送线程,只唤醒一次
+int ipc_server::broadcast_msg_to_subscriber(const message_ptr &origin) {
+    // 编号与取得订阅者列表在同一次加锁中完成,订阅时据此划分补发和推送的事件.
+    // 没有订阅者时同样编号并保留原始事件,重启的客户端可以补发期间的事件
+    uint64_t seq;
+    message_ptr evicted;
+    std::shared_ptr<const subscription_list> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(sub_mutex_);
+        evicted = replay_.push(origin, seq);
+        snapshot = sub_.resolve(origin->type());
     }
+    if (snapshot->empty())
+        return 0;
+
+    // 过滤,抽样和聚合在写入发送队列前完成,被过滤的事件不会被序列化为其他编码格式.
+    // 聚合的订阅需要对每个事件计数,不能在某个订阅决定推送后跳过其余的订阅.
+    // 带编号的副本在第一次需要推送时才生成
+    thread_local std::vector<subscriber> scheduled;
+    message_ptr msg;
+    event_fields fields(origin);
+    for (const subscriber &target : *snapshot) {
+        if (target.out->closed)
+            continue;
+        if (target.routes) {
+            bool accepted = false;
+            for (const auto &route : *target.routes)
+                accepted = (!route || route->accept(fields)) || accepted;
+            if (!accepted)
+                continue;
+        } else if (target.filter && !target.filter->match(fields)) {
+            continue;
+        }
+        if (!msg)
+            msg = replay_ring::stamp(origin, replay_.epoch(), seq);
+        enqueue(target, msg, scheduled);
+    }
+    schedule(scheduled);
     return 0;
 }
 
-int ipc_server::broadcast_msg_to_subscriber(const nlohmann::json &doc) {
-    std::string section = doc["type"];
-    nlohmann::json data = doc["data"];
-    return broadcast_msg_to_subscriber(section, json::dump(data));
+void ipc_server::enqueue(const subscriber &target, const message_ptr &msg, std::vector<subscriber> &scheduled) {
+    outbound &out = *target.out;
+    if (!out.queue.push(msg)) {
+        overflow(target, msg);
+        return;
+    }
+    if (!out.scheduled.exchange(true))
+        scheduled.push_back(target);
 }
 
-int ipc_server::broadcast_msg_to_subscriber(const std::string &section, const std::string &msg) {
-    struct sockaddr *peer;
-    socklen_t len;
-    std::lock_guard<std::mutex> lock(sub_mutex_);
+// 一批事件写入发送队列后只唤醒一次发送线程
+void ipc_server::schedule(std::vector<subscriber> &scheduled) {
+    if (scheduled.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(flush_mutex_);
+        ready_.insert(ready_.end(), scheduled.begin(), scheduled.end());
+    }
+    scheduled.clear();
+    wake_flush();
+}
+
+void ipc_server::wake_flush() {
+    uint64_t value = 1;
+    if (write(flush_event_, &value, sizeof(value)) == -1 && errno != EAGAIN)
+        WARN("wake flush thread failed, errno=[%d]", errno);
+}
+
+// 定时器只持有弱引用,取消订阅或重新订阅后聚合随之释放,定时任务不再继续
+void ipc_server::schedule_aggregate(const std::shared_ptr<aggregator> &aggregate) {
+    timer::event event;
+    event.time_point = std::chrono::system_clock::now() + aggregate->interval;
+    event.func = [weak = std::weak_ptr<aggregator>(aggregate)]() { ipc_server::global().emit_aggregate(weak); };
+    timer::timer::global().insert(event);
+}
+
+// 每个周期都推送一次,没有事件时计数为 0, 便于按周期计算速率
+void ipc_server::emit_aggregate(const std::weak_ptr<aggregator> &weak) {
+    std::shared_ptr<aggregator> aggregate = weak.lock();
+    if (!aggregate || !flushing_)
+        return;
+
+    subscriber target;
+    {
+        std::lock_guard<std::mutex> lock(sub_mutex_);
+        if (sub_.find(aggregate->peer, target))
+            return;
+    }
+
+    std::vector<subscriber> scheduled;
+    if (!target.out->closed)
+        enqueue(target, generate_system_broadcast_msg(aggregate->take()), scheduled);
+    schedule(scheduled);
+    schedule_aggregate(aggregate);
+}
+
+// 写入发送队列时可能持有 sub_mutex_, 断开的订阅者交给发送线程取消订阅
+void ipc_server::overflow(const subscriber &target, const message_ptr &msg) {
+    outbound &out = *target.out;
+    out.dropped.fetch_add(1, std::memory_order_relaxed);
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+
+    switch (out.action.load()) {
+    case overflow_action::drop:
+        break;
+    case overflow_action::summary: {
+        std::lock_guard<std::mutex> lock(out.omitted_mutex);
+        auto it = out.omitted.find(msg->type());
+        if (it == out.omitted.end())
+            out.omitted.emplace(msg->type(), 1);
+        else
+            ++it->second;
+        break;
+    }
+    case overflow_action::disconnect:
+        if (out.closed.exchange(true))
+            break;
+        WARN("subscriber too slow, disconnect, peer=[%s]", target.conn.peer.sun_path);
+        disconnected_.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(flush_mutex_);
+            disconnecting_.emplace_back(peer_name(target.conn));
+        }
+        wake_flush();
+        if (target.conn.stream)
+            shutdown(target.conn.stream->fd, SHUT_RDWR);
+        break;
+    }
+}
+
+// summary 策略下积压清空后推送的汇总事件
+static message_ptr make_summary(outbound &out) {
+    std::map<std::string, uint64_t, std::less<>> omitted;
+    {
+        std::lock_guard<std::mutex> lock(out.omitted_mutex);
+        if (out.omitted.empty())
+            return nullptr;
+        omitted.swap(out.omitted);
+    }
+
+    nlohmann::json data;
+    data["type"] = "user::msg::summary";
+    data["omitted"] = omitted;
+    return generate_system_broadcast_msg(data);
+}
 
-    for (auto it = sub_[section].begin(); it != sub_[section].end();) {
-        user_conn &conn = it->conn;
-        peer = (struct sockaddr *)conn.peer.get();
-        len = conn.len;
+// 轮流从每个订阅者的队列中取出一条事件,数据报订阅者通过 sendmmsg 批量发送.
+// 对端接收队列已满的订阅者保留当前事件,面向连接的订阅者等待 EPOLLOUT,
+// 数据报订阅者无法得知对端何时可写,间隔一段时间后重试.
+// 持续繁忙的订阅者不能独占发送线程,超过轮数上限后未发完的订阅者留在 round 中下次继续
+void ipc_server::flush(std::vector<subscriber> &round, flush_state &state) {
+    thread_local std::vector<struct mmsghdr> headers;
+    thread_local std::vector<struct iovec> iovecs;
+    thread_local std::vector<subscriber> targets;
+    std::vector<subscriber> next;
+    std::vector<std::string> dead;
+    std::vector<std::shared_ptr<shm_channel>> written;
 
-        if (sendto(socket_, msg.data(), msg.size(), 0, peer, len) == -1) {
-            WARN("broadcast error, peer=[%s], msg=[%s]", ((struct sockaddr_un *)peer)->sun_path, msg.data());
-            it = sub_[section].erase(it);
+    auto complete = [&](const subscriber &target, int error) {
+        outbound &out = *target.out;
+        if (!error) {
+            out.head.reset();
+            out.sent.fetch_add(1, std::memory_order_relaxed);
+            sent_.fetch_add(1, std::memory_order_relaxed);
+            next.push_back(target);
+        } else if (error == EAGAIN || error == EWOULDBLOCK) {
+            out.blocked.fetch_add(1, std::memory_order_relaxed);
+            blocked_.fetch_add(1, std::memory_order_relaxed);
+            if (!target.conn.stream || target.conn.stream->channel.load()) {
+                state.retry.push_back(target);
+                return;
+            }
+
+            struct epoll_event event = {};
+            event.events = EPOLLOUT | EPOLLONESHOT;
+            event.data.fd = target.conn.stream->fd;
+            if (epoll_ctl(state.epoll, EPOLL_CTL_ADD, event.data.fd, &event) && errno == EEXIST)
+                epoll_ctl(state.epoll, EPOLL_CTL_MOD, event.data.fd, &event);
+            state.waiting[event.data.fd] = target;
+        } else if (is_dead_peer(error)) {
+            WARN("subscriber closed, peer=[%s] errno=[%d]", target.conn.peer.sun_path, error);
+            out.head.reset();
+            out.closed = true;
+            dead.emplace_back(peer_name(target.conn));
+            dead_.fetch_add(1, std::memory_order_relaxed);
         } else {
-            ++it;
+            WARN("broadcast error, peer=[%s] errno=[%d] msg=[%s]", target.conn.peer.sun_path, error,
+                 printable(target.conn, out.head->payload(target.conn.format)));
+            out.head.reset();
+            out.dropped.fetch_add(1, std::memory_order_relaxed);
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            next.push_back(target);
+        }
+    };
+
+    for (size_t rounds = 0; rounds < IPC_FLUSH_ROUNDS && !round.empty() && flushing_; ++rounds) {
+        for (size_t begin = 0; begin < round.size(); begin += IPC_SEND_BATCH) {
+            size_t count = std::min(IPC_SEND_BATCH, round.size() - begin);
+            headers.clear();
+            targets.clear();
+            iovecs.resize(count);
+            for (size_t i = begin; i < begin + count; ++i) {
+                const subscriber &target = round[i];
+                outbound &out = *target.out;
+                if (out.closed) {
+                    message_ptr discard;
+                    while (out.queue.pop(discard))
+                        ;
+                    out.head.reset();
+                    continue;
+                }
+
+                if (!out.head && !out.queue.pop(out.head) && !(out.head = make_summary(out))) {
+                    // 清除标记后可能又有新的事件写入,此时由发送线程继续处理
+                    out.scheduled = false;
+                    if (!out.queue.empty() && !out.scheduled.exchange(true))
+                        next.push_back(target);
+                    continue;
+                }
+
+                std::string_view payload = out.head->payload(target.conn.format);
+                // 共享内存通道只在一轮结束后唤醒一次客户端
+                if (target.conn.stream) {
+                    if (auto channel = target.conn.stream->channel.load()) {
+                        int retval = channel->write(payload);
+                        if (!retval)
+                            written.push_back(channel);
+                        complete(target, -retval);
+                        continue;
+                    }
+                }
+                // 每条连接有各自的描述符,不能合并到同一次 sendmmsg 中
+                if (target.conn.stream) {
+                    ssize_t retval =
+                        send(target.conn.stream->fd, payload.data(), payload.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+                    complete(target, retval == -1 ? errno : 0);
+                    continue;
+                }
+
+                struct iovec &iov = iovecs[targets.size()];
+                iov.iov_base = (void *)payload.data();
+                iov.iov_len = payload.size();
+                struct mmsghdr header = {};
+                header.msg_hdr.msg_name = (void *)&target.conn.peer;
+                header.msg_hdr.msg_namelen = target.conn.len;
+                header.msg_hdr.msg_iov = &iov;
+                header.msg_hdr.msg_iovlen = 1;
+                headers.push_back(header);
+                targets.push_back(target);
+            }
+
+            // 某条发送失败时 sendmmsg 返回之前成功的数量,失败的那条在下一次调用时报告错误
+            size_t done = 0;
+            while (done < targets.size()) {
+                int retval = sendmmsg(socket_, headers.data() + done, targets.size() - done, MSG_DONTWAIT);
+                if (retval > 0) {
+                    for (int i = 0; i < retval; ++i)
+                        complete(targets[done + i], 0);
+                    done += retval;
+                    continue;
+                }
+                if (errno == EINTR)
+                    continue;
+
+                complete(targets[done], errno);
+                ++done;
+            }
         }
+        for (const auto &channel : written)
+            channel->notify();
+        written.clear();
+        round.swap(next);
+        next.clear();
+    }
+
+    if (!dead.empty())
+        remove_subscriber(std::vector<std::string_view>(dead.begin(), dead.end()));
+}
+
+int ipc_server::start_flush() {
+    flush_state state;
+    struct epoll_event events[IPC_EPOLL_EVENTS];
+    struct epoll_event event = {};
+    struct itimerspec retry = {};
+    std::vector<subscriber> round;
+    std::vector<std::string> disconnecting;
+
+    retry.it_value.tv_nsec = std::chrono::nanoseconds(IPC_FLUSH_RETRY).count();
+
+    state.epoll = epoll_create1(0);
+    if (state.epoll == -1) {
+        ERR("epoll create failed");
+        goto errout;
     }
+
+    state.timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (state.timer == -1) {
+        ERR("timerfd create failed");
+        goto errout;
+    }
+
+    event.events = EPOLLIN;
+    event.data.fd = flush_event_;
+    if (epoll_ctl(state.epoll, EPOLL_CTL_ADD, flush_event_, &event)) {
+        ERR("epoll add failed");
+        goto errout;
+    }
+
+    event.data.fd = state.timer;
+    if (epoll_ctl(state.epoll, EPOLL_CTL_ADD, state.timer, &event)) {
+        ERR("epoll add failed");
+        goto errout;
+    }
+
+    while (flushing_ && current_service_status()) {
+        // 上次没有发完时只检查已经就绪的事件,不阻塞
+        int count = epoll_wait(state.epoll, events, IPC_EPOLL_EVENTS, round.empty() ? -1 : 0);
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            ERR("epoll_wait errno=[%d] errmsg=[%s]", errno, strerror(errno));
+            goto errout;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            uint64_t value;
+            if (fd == flush_event_) {
+                if (read(flush_event_, &value, sizeof(value)) == -1 && errno != EAGAIN)
+                    WARN("read flush event failed, errno=[%d]", errno);
+                continue;
+            }
+
+            if (fd == state.timer) {
+                if (read(state.timer, &value, sizeof(value)) == -1 && errno != EAGAIN)
+                    WARN("read flush timer failed, errno=[%d]", errno);
+                state.armed = false;
+                round.insert(round.end(), state.retry.begin(), state.retry.end());
+                state.retry.clear();
+                continue;
+            }
+
+            auto it = state.waiting.find(fd);
+            if (it == state.waiting.end())
+                continue;
+            epoll_ctl(state.epoll, EPOLL_CTL_DEL, fd, NULL);
+            round.push_back(std::move(it->second));
+            state.waiting.erase(it);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(flush_mutex_);
+            round.insert(round.end(), ready_.begin(), ready_.end());
+            ready_.clear();
+            disconnecting.swap(disconnecting_);
+        }
+        if (!disconnecting.empty()) {
+            remove_subscriber(std::vector<std::string_view>(disconnecting.begin(), disconnecting.end()));
+            disconnecting.clear();
+        }
+        flush(round, state);
+
+        if (!state.retry.empty() && !state.armed) {
+            if (timerfd_settime(state.timer, 0, &retry, NULL))
+                WARN("arm flush timer failed, errno=[%d]", errno);
+            else
+                state.armed = true;
+        }
+    }
+
+    close(state.timer);
+    close(state.epoll);
+    flush_exited_ = true;
+    flush_exited_.notify_all();
+    return 0;
+
+errout:
+    if (state.timer != -1)
+        close(state.timer);
+    if (state.epoll != -1)
+        close(state.epoll);
+    flush_exited_ = true;
+    flush_exited_.notify_all();
+    shutdown_service(HACKERNEL_UNIX_DOMAIN_SOCKET);
+    return -EPERM;
+}
+
+int ipc_server::remove_subscriber(const std::vector<std::string_view> &peers) {
+    std::lock_guard<std::mutex> lock(sub_mutex_);
+    for (std::string_view peer : peers)
+        sub_.remove(peer);
     return 0;
 }
 
+nlohmann::json ipc_server::stats() {
+    nlohmann::json doc;
+    std::vector<subscriber> subscribers;
+    {
+        std::lock_guard<std::mutex> lock(sub_mutex_);
+        doc["sections"] = sub_.topic_count();
+        doc["subscribers"] = sub_.peer_count();
+        subscribers = sub_.subscribers();
+        doc["seq"] = replay_.last();
+    }
+    doc["epoch"] = replay_.epoch();
+    doc["sent"] = sent_.load(std::memory_order_relaxed);
+    doc["blocked"] = blocked_.load(std::memory_order_relaxed);
+    doc["dropped"] = dropped_.load(std::memory_order_relaxed);
+    doc["disconnected"] = disconnected_.load(std::memory_order_relaxed);
+    doc["dead"] = dead_.load(std::memory_order_relaxed);
+
+    // 有积压或丢弃过事件的订阅者
+    doc["slow"] = nlohmann::json::array();
+    for (const subscriber &target : subscribers) {
+        const outbound &out = *target.out;
+        size_t queued = out.queue.size();
+        uint64_t dropped = out.dropped.load(std::memory_order_relaxed);
+        if (!queued && !dropped)
+            continue;
+
+        // 抽象命名空间的地址按惯例以 '@' 显示
+        std::string peer(peer_name(target.conn));
+        if (peer.starts_with('\0'))
+            peer[0] = '@';
+        nlohmann::json item;
+        item["peer"] = peer;
+        item["queued"] = queued;
+        item["sent"] = out.sent.load(std::memory_order_relaxed);
+        item["dropped"] = dropped;
+        item["blocked"] = out.blocked.load(std::memory_order_relaxed);
+        item["overflow"] = overflow_action_name(out.action);
+        doc["slow"].push_back(item);
+    }
+    return doc;
+}
+
 int ipc_server::update_token(const std::string &token) {
     token_.update(token);
     return 0;
 }
 
-bool ipc_server::check_token(const nlohmann::json &data) {
+// 已订阅的连接保存了编码格式的副本,需要一并更新
+int ipc_server::update_format(const user_conn &user, wire_format format) {
+    std::string_view peer = peer_name(user);
+    if (user.stream)
+        user.stream->format = format;
+    else if (format == wire_format::json)
+        formats_.erase(std::string(peer));
+    else
+        formats_.put(std::string(peer), format);
+
+    std::lock_guard<std::mutex> lock(sub_mutex_);
+    sub_.update_format(peer, format);
+    return 0;
+}
+
+// 每条连接只能打开一次,通道随连接关闭释放
+int ipc_server::open_channel(const user_conn &user, size_t capacity, std::shared_ptr<shm_channel> &channel) {
+    if (!user.stream)
+        return -EPERM;
+
+    std::shared_ptr<shm_channel> current, expected;
+    int error = shm_channel::create(capacity, current);
+    if (error)
+        return error;
+    if (!user.stream->channel.compare_exchange_strong(expected, current))
+        return -EPERM;
+
+    channel = current;
+    return 0;
+}
+
+// 数据报客户端的每个请求都会延长格式设置的存活时间
+wire_format ipc_server::current_format(const user_conn &conn) {
+    if (conn.stream)
+        return conn.stream->format;
+
+    std::string peer(peer_name(conn));
+    sharded_lru<std::string, wire_format, string_hash>::handle format;
+    if (formats_.get(peer, format))
+        return wire_format::json;
+    formats_.put(peer, *format);
+    return *format;
+}
+
+bool ipc_server::check_token(const nlohmann::json &token) {
     if (!token_.is_enabled())
         return true;
-    if (!data.contains("token"))
+    if (!token.is_string())
         return false;
-    if (!data["token"].is_string())
-        return false;
-    return token_.is_vaild(data["token"]);
+    return token_.is_vaild(token);
+}
+
+// Json 请求只提取接收时需要的字段,原始文本直接作为消息的 data 转发,
+// 完整的文档由处理该类型的 handler 在首次使用时解析.
+// 请求中没有 extra 时在 buffer 中补充为 null,保证响应中总是带有 extra
+static int scan_request(std::string_view text, request_header &header, std::string &buffer, std::string_view &payload) {
+    if (!nlohmann::json::accept(text) || json::check_depth(text))
+        return -EINVAL;
+
+    bool extra = false;
+    size_t count = 0;
+    int error = json::scan(text, [&](const std::string &key, std::string_view value) {
+        ++count;
+        if (key == "type")
+            header.type = nlohmann::json::parse(value);
+        else if (key == "token")
+            header.token = nlohmann::json::parse(value);
+        else if (key == "extra") {
+            header.extra = nlohmann::json::parse(value);
+            extra = true;
+        }
+    });
+    if (error)
+        return error;
+
+    if (extra) {
+        payload = text;
+        return 0;
+    }
+
+    size_t pos = text.find('{') + 1;
+    buffer.clear();
+    buffer.append(text.substr(0, pos)).append(count ? "\"extra\":null," : "\"extra\":null").append(text.substr(pos));
+    payload = buffer;
+    return 0;
+}
+
+// 二进制编码的请求需要完整解码后转换为 Json
+static int decode_request(std::string_view msg, wire_format format, request_header &header, nlohmann::json &data) {
+    try {
+        data = json::decode(msg, format);
+    } catch (nlohmann::json::exception &ex) {
+        return -EINVAL;
+    }
+    if (!data.is_object())
+        return -EINVAL;
+
+    if (data.contains("type"))
+        header.type = data["type"];
+    if (data.contains("token"))
+        header.token = data["token"];
+    header.extra = data["extra"];
+    return 0;
+}
+
+// 批量接收的缓冲区池.每个槽位预留最大请求长度的虚拟内存,只有实际写入的页才占用物理内存,
+// 大请求超出常驻长度的部分在处理完成后归还
+class recv_pool {
+public:
+    ~recv_pool() {
+        if (memory_)
+            munmap(memory_, IPC_RECV_BATCH * SLOT_SIZE);
+    }
+
+    int init() {
+        memory_ = (char *)mmap(NULL, IPC_RECV_BATCH * SLOT_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (memory_ == MAP_FAILED) {
+            memory_ = nullptr;
+            return -ENOMEM;
+        }
+
+        memset(headers_, 0, sizeof(headers_));
+        for (size_t i = 0; i < IPC_RECV_BATCH; ++i) {
+            iov_[i].iov_base = slot(i);
+            iov_[i].iov_len = IPC_REQUEST_MAX;
+            headers_[i].msg_hdr.msg_iov = &iov_[i];
+            headers_[i].msg_hdr.msg_iovlen = 1;
+            headers_[i].msg_hdr.msg_name = &peers_[i];
+            headers_[i].msg_hdr.msg_namelen = sizeof(peers_[i]);
+        }
+        return 0;
+    }
+
+    struct mmsghdr *headers() {
+        return headers_;
+    }
+
+    char *slot(size_t index) {
+        return memory_ + index * SLOT_SIZE;
+    }
+
+    const struct sockaddr_un &peer(size_t index) {
+        return peers_[index];
+    }
+
+    void reset(size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            size_t used = headers_[i].msg_len + 1;
+            if (used > IPC_RECV_RESIDENT)
+                madvise(slot(i) + IPC_RECV_RESIDENT, used - IPC_RECV_RESIDENT, MADV_DONTNEED);
+            headers_[i].msg_hdr.msg_namelen = sizeof(peers_[i]);
+            headers_[i].msg_hdr.msg_flags = 0;
+        }
+    }
+
+private:
+    // 多预留一页用于在结尾补 '\0',同时保持槽位按页对齐
+    static const size_t SLOT_SIZE = IPC_REQUEST_MAX + 4096;
+
+    char *memory_ = nullptr;
+    struct mmsghdr headers_[IPC_RECV_BATCH];
+    struct iovec iov_[IPC_RECV_BATCH];
+    struct sockaddr_un peers_[IPC_RECV_BATCH];
+};
+
+message_ptr ipc_server::accept_request(char *buffer, size_t size, user_conn conn, std::string &spliced) {
+    buffer[size] = 0;
+    conn.format = current_format(conn);
+
+    request_header header;
+    std::string_view payload;
+    nlohmann::json data;
+    int error = conn.format == wire_format::json
+                    ? scan_request(std::string_view(buffer, size), header, spliced, payload)
+                    : decode_request(std::string_view(buffer, size), conn.format, header, data);
+    if (error) {
+        WARN("parse error, buffer=[%s]", printable(conn, buffer));
+        return nullptr;
+    }
+
+    if (!header.type.is_string()) {
+        WARN("invalid request, buffer=[%s]", printable(conn, buffer));
+        return nullptr;
+    }
+
+    if (!check_token(header.token)) {
+        WARN("invalid token, buffer=[%s]", printable(conn, buffer));
+        return nullptr;
+    }
+
+    conn.extra = std::move(header.extra);
+    session session = generate_user_session();
+    if (conn.stream) {
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(stream_mutex_);
+        expire_sessions(*conn.stream, now);
+        if (conn.stream->sessions.size() >= IPC_STREAM_PENDING_MAX) {
+            WARN("too many pending requests, fd=[%d]", conn.stream->fd);
+            return nullptr;
+        }
+        conn.stream->sessions.insert(session);
+        conn.stream->expiry.emplace_back(now + IPC_SESSION_TTL, session);
+        streams_[session] = std::make_shared<const user_conn>(conn);
+    } else {
+        ipc_server::global().clients.put(session, conn);
+    }
+
+    if (conn.format == wire_format::json)
+        return message::make(session, header.type.get_ref<const std::string &>(), payload);
+
+    nlohmann::json doc;
+    doc["session"] = session;
+    doc["type"] = header.type;
+    doc["data"] = std::move(data);
+    return message::make(std::move(doc));
 }
 
 int ipc_server::start_unix_domain_socket() {
     static const char *SOCK_PATH = "/tmp/hackernel.sock";
-    static const int BUFFER_SIZE = 1024 * 1024;
 
-    char buffer[BUFFER_SIZE + 1];
+    recv_pool pool;
+    std::vector<message_ptr> batch;
+    std::string spliced;
     struct sockaddr_un server;
 
     socket_ = socket(AF_UNIX, SOCK_DGRAM, 0);
@@ -227,70 +1210,253 @@ int ipc_server::start_unix_domain_socket() {
         goto errout;
     }
 
-    socklen_t len;
-    struct sockaddr_un peer;
+    if (pool.init()) {
+        ERR("receive buffer create failed");
+        goto errout;
+    }
+
     running_ = current_service_status();
     while (running_) {
-        len = sizeof(peer);
-        int size = recvfrom(socket_, buffer, BUFFER_SIZE, 0, (struct sockaddr *)&peer, &len);
+        // 阻塞到第一个数据报到达,之后取走已经到达的数据报,整批交给广播
+        int count = recvmmsg(socket_, pool.headers(), IPC_RECV_BATCH, MSG_WAITFORONE, NULL);
 
-        if (size <= 0) {
-            if (!size || errno == EAGAIN || errno == EINTR)
+        if (count <= 0) {
+            if (!count || errno == EAGAIN || errno == EINTR)
                 continue;
 
-            ERR("recvfrom errno=[%d] errmsg=[%s]", errno, strerror(errno));
+            ERR("recvmmsg errno=[%d] errmsg=[%s]", errno, strerror(errno));
             goto errout;
         }
-        buffer[size] = 0;
 
-        nlohmann::json data;
-        try {
-            data = json::parse(buffer);
-        } catch (nlohmann::json::parse_error &ex) {
-            WARN("parse error, buffer=[%s]", buffer);
-            continue;
+        for (int i = 0; i < count; ++i) {
+            struct msghdr &header = pool.headers()[i].msg_hdr;
+            if (header.msg_flags & MSG_TRUNC) {
+                WARN("request too large, peer=[%s]", pool.peer(i).sun_path);
+                continue;
+            }
+
+            user_conn conn;
+            conn.peer = pool.peer(i);
+            conn.len = header.msg_namelen;
+            message_ptr msg = accept_request(pool.slot(i), pool.headers()[i].msg_len, std::move(conn), spliced);
+            if (msg)
+                batch.push_back(std::move(msg));
         }
 
-        if (!data.contains("type") || !data["type"].is_string()) {
-            WARN("invalid request, buffer=[%s]", buffer);
-            continue;
+        broadcaster::global().broadcast(batch);
+        batch.clear();
+        pool.reset(count);
+    }
+
+    unlink(SOCK_PATH);
+    flush_exited_.wait(false);
+    close(socket_);
+    return 0;
+
+errout:
+    unlink(SOCK_PATH);
+    shutdown_service(HACKERNEL_UNIX_DOMAIN_SOCKET);
+    flush_exited_.wait(false);
+    close(socket_);
+    return -EPERM;
+}
+
+// 连接的对端通常没有绑定地址,用递增的编号生成抽象命名空间中的名字,
+// 订阅与数据报客户端一样按名字记录,编码格式保存在连接上
+int ipc_server::accept_stream(int epoll) {
+    for (;;) {
+        int fd = accept(stream_socket_, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            WARN("accept errno=[%d] errmsg=[%s]", errno, strerror(errno));
+            return -EPERM;
         }
 
-        if (!check_token(data)) {
-            WARN("invalid token, buffer=[%s]", buffer);
+        user_conn conn;
+        memset(&conn.peer, 0, sizeof(conn.peer));
+        conn.peer.sun_family = AF_UNIX;
+        int len = snprintf(conn.peer.sun_path + 1, sizeof(conn.peer.sun_path) - 1, "hackernel-stream-%lu",
+                           ++connection_id_);
+        conn.len = offsetof(struct sockaddr_un, sun_path) + 1 + len;
+        conn.stream = std::make_shared<stream_conn>(fd);
+
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event)) {
+            WARN("epoll add errno=[%d] errmsg=[%s]", errno, strerror(errno));
             continue;
         }
+        connections_[fd] = std::move(conn);
+    }
+}
 
-        user_conn conn;
-        conn.peer = std::make_shared<struct sockaddr_un>(peer);
-        conn.len = len;
-        conn.extra = data["extra"];
-        session session = generate_user_session();
-        ipc_server::global().clients.put(session, conn);
+// 连接关闭后它的订阅,编码格式和未响应的请求都不再保留
+void ipc_server::close_stream(int epoll, int fd) {
+    auto it = connections_.find(fd);
+    if (it == connections_.end())
+        return;
 
-        nlohmann::json doc;
-        doc["session"] = session;
-        doc["type"] = std::string(data["type"]);
-        doc["data"] = data;
-        broadcaster::global().broadcast(json::dump(doc));
+    epoll_ctl(epoll, EPOLL_CTL_DEL, fd, NULL);
+    const user_conn &conn = it->second;
+    std::string_view peer = peer_name(conn);
+    remove_subscriber({peer});
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex_);
+        for (session session : conn.stream->sessions)
+            streams_.erase(session);
+        conn.stream->sessions.clear();
+        conn.stream->expiry.clear();
     }
+    connections_.erase(it);
+}
 
-    close(socket_);
+// SOCK_SEQPACKET 保留消息边界,每次读取就是一个完整的请求.
+// 可读的连接每次最多读取一批请求,整批交给广播
+int ipc_server::start_stream_socket() {
+    static const char *SOCK_PATH = "/tmp/hackernel.seqpacket.sock";
+
+    recv_pool pool;
+    std::vector<message_ptr> batch;
+    std::string spliced;
+    struct sockaddr_un server;
+    struct epoll_event events[IPC_EPOLL_EVENTS];
+    struct epoll_event event = {};
+    int epoll = -1;
+    bool listening = true;
+
+    stream_socket_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0);
+    if (stream_socket_ == -1) {
+        ERR("unix domain stream socket create failed");
+        goto errout;
+    }
+
+    server.sun_family = AF_UNIX;
+    strcpy(server.sun_path, SOCK_PATH);
+
+    if (unlink(SOCK_PATH) && errno == EPERM) {
+        ERR("unlink unix domain stream socket file failed");
+        goto errout;
+    }
+
+    if (bind(stream_socket_, (struct sockaddr *)&server, sizeof(server)) == -1) {
+        ERR("unix domain stream socket bind failed");
+        goto errout;
+    }
+
+    if (listen(stream_socket_, SOMAXCONN) == -1) {
+        ERR("unix domain stream socket listen failed");
+        goto errout;
+    }
+
+    if (pool.init()) {
+        ERR("receive buffer create failed");
+        goto errout;
+    }
+
+    epoll = epoll_create1(0);
+    if (epoll == -1) {
+        ERR("epoll create failed");
+        goto errout;
+    }
+
+    event.events = EPOLLIN;
+    event.data.fd = stream_socket_;
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, stream_socket_, &event)) {
+        ERR("epoll add failed");
+        goto errout;
+    }
+
+    while (listening && current_service_status()) {
+        int count = epoll_wait(epoll, events, IPC_EPOLL_EVENTS, -1);
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            ERR("epoll_wait errno=[%d] errmsg=[%s]", errno, strerror(errno));
+            goto errout;
+        }
+
+        size_t used = 0;
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == stream_socket_) {
+                // 服务停止时监听 socket 被 shutdown
+                if (events[i].events & (EPOLLHUP | EPOLLERR))
+                    listening = false;
+                else
+                    accept_stream(epoll);
+                continue;
+            }
+
+            auto it = connections_.find(fd);
+            if (it == connections_.end())
+                continue;
+
+            // 未读完的请求在下一次 epoll_wait 时继续读取
+            while (used < IPC_RECV_BATCH) {
+                ssize_t size = recv(fd, pool.slot(used), IPC_REQUEST_MAX, MSG_DONTWAIT | MSG_TRUNC);
+                if (size == -1 && errno == EINTR)
+                    continue;
+                if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    break;
+                if (size <= 0) {
+                    close_stream(epoll, fd);
+                    break;
+                }
+                if ((size_t)size > IPC_REQUEST_MAX) {
+                    WARN("request too large, fd=[%d]", fd);
+                    continue;
+                }
+
+                pool.headers()[used].msg_len = size;
+                message_ptr msg = accept_request(pool.slot(used), size, it->second, spliced);
+                ++used;
+                if (msg)
+                    batch.push_back(std::move(msg));
+            }
+        }
+
+        broadcaster::global().broadcast(batch);
+        batch.clear();
+        pool.reset(used);
+    }
+
+    for (auto &[fd, conn] : connections_)
+        epoll_ctl(epoll, EPOLL_CTL_DEL, fd, NULL);
+    connections_.clear();
+    close(epoll);
+    close(stream_socket_);
     unlink(SOCK_PATH);
     return 0;
 
 errout:
-    close(socket_);
+    if (epoll != -1)
+        close(epoll);
+    close(stream_socket_);
     unlink(SOCK_PATH);
     shutdown_service(HACKERNEL_UNIX_DOMAIN_SOCKET);
     return -EPERM;
 }
 
+// 接收线程和工作线程会同时分配,只能使用自增的结果,不能再次读取 id_
 session ipc_server::generate_user_session() {
+    session session;
     do {
-        ++id_;
-    } while (id_ == SYSTEM_SESSION);
-    return id_;
+        session = ++id_;
+    } while (session == SYSTEM_SESSION);
+    return session;
+}
+
+// 分配 count 个连续的 session, 返回第一个.包含 SYSTEM_SESSION 的范围整段放弃
+session ipc_server::generate_user_sessions(size_t count) {
+    for (;;) {
+        uint32_t first = (uint32_t)id_.fetch_add((session)count) + 1;
+        if ((uint32_t)(SYSTEM_SESSION - first) >= count)
+            return (session)first;
+    }
 }
 
 int start_ipc_server() {
@@ -4,25 +4,87 @@
 
 #include "hackernel/ipc.h"
 #include "hackernel/lru.h"
+#include "ipc/channel.h"
+#include "ipc/replay.h"
+#include "ipc/subscription.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <list>
-#include <map>
 #include <memory>
 #include <mutex>
 #include <shared_mutex>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace hackernel {
 
 namespace ipc {
 
-typedef lru<session, user_conn> conn_cache;
+typedef sharded_lru<session, user_conn> conn_cache;
+
+static const size_t IPC_WORKER_MAX = 4;
+// 一次 recvmmsg 最多接收的数据报数量
+static const size_t IPC_RECV_BATCH = 64;
+// 一次 sendmmsg 最多推送给的订阅者数量
+static const size_t IPC_SEND_BATCH = 64;
+// 发送线程每次连续发送的轮数上限,之后回到 epoll_wait 接收新加入和可以重试的订阅者
+static const size_t IPC_FLUSH_ROUNDS = 16;
+// 数据报订阅者接收队列已满后重试发送的间隔
+static const std::chrono::microseconds IPC_FLUSH_RETRY(200);
+static const size_t IPC_REQUEST_MAX = 1024 * 1024;
+// 接收缓冲区中常驻内存的长度,更大的请求处理完成后释放多出的部分
+static const size_t IPC_RECV_RESIDENT = 64 * 1024;
+// 每条连接未响应的请求数量上限,超出后丢弃新的请求
+static const size_t IPC_STREAM_PENDING_MAX = 1024;
+static const size_t IPC_EPOLL_EVENTS = 64;
+// session 只用于关联请求与响应,长时间没有响应的 session 直接过期
+static const std::chrono::seconds IPC_SESSION_TTL(60);
+// 单个批量请求最多包含的命令数量
+static const size_t IPC_BATCH_MAX = 8192;
+// 所有批量请求中尚未响应的命令数量上限,命令和响应都经过消息队列,不能超过队列容量
+static const size_t IPC_BATCH_PENDING_MAX = 16384;
+// 记录编码格式的数据报客户端数量上限.对端关闭时服务不会得到通知,超过存活时间没有请求的设置随之失效
+static const size_t IPC_FORMAT_MAX = 1024;
+static const std::chrono::seconds IPC_FORMAT_TTL(3600);
+// 批量请求中的命令没有全部响应时,超时后以 -ETIMEDOUT 补齐并回复
+static const std::chrono::seconds IPC_BATCH_TIMEOUT(10);
+
+// 面向连接的客户端.连接上每个请求仍然有独立的 session,在响应后,连接关闭时或
+// 超过 IPC_SESSION_TTL 后释放,不会因为缓存容量而丢失.最后一个引用释放时才关闭连接,避免描述符被复用
+struct stream_conn {
+    int fd;
+    // 尚未响应的请求及其过期时间,按接收顺序排列,由 ipc_server::stream_mutex_ 保护
+    std::unordered_set<session> sessions;
+    std::deque<std::pair<std::chrono::steady_clock::time_point, session>> expiry;
+    // 打开共享内存通道后,订阅的事件写入通道而不再通过 socket 发送
+    std::atomic<std::shared_ptr<shm_channel>> channel;
+    // 连接的编码格式,随连接一起释放
+    std::atomic<wire_format> format = wire_format::json;
+
+    explicit stream_conn(int fd);
+    ~stream_conn();
+};
+
+// 批量请求.每条命令分配独立的 session 并按普通请求分发,
+// 命令的响应不发给客户端,全部响应后合并为一条回复
+struct batch_state {
+    session id;
+    conn_cache::handle conn;
+    // 每条命令的 session 和响应码,与请求中的顺序一致
+    std::vector<session> sessions;
+    std::vector<int> codes;
+    size_t pending = 0;
+};
 
-struct user_conn_counter {
-    user_conn conn;
-    int counter;
+// 接收请求时用于路由和鉴权的字段,不存在时为 null
+struct request_header {
+    nlohmann::json type;
+    nlohmann::json token;
+    nlohmann::json extra;
 };
 
 class token {
@@ -36,6 +98,18 @@ private:
     std::list<std::string> tokens_;
 };
 
+// 发送线程的状态
+struct flush_state {
+    int epoll = -1;
+    // 数据报订阅者的重试定时器
+    int timer = -1;
+    bool armed = false;
+    // 等待 EPOLLOUT 的面向连接的订阅者
+    std::unordered_map<int, subscriber> waiting;
+    // 稍后重试的数据报订阅者
+    std::vector<subscriber> retry;
+};
+
 class ipc_server {
 public:
     static ipc_server &global();
@@ -45,30 +119,89 @@ public:
     int start();
     int stop();
 
-    int handle_msg_sub(const std::string &section, const user_conn &user);
+    // resume.seq 不为 0 时先补发编号不小于它的事件,current 返回订阅生效时最近一个事件的位置
+    int handle_msg_sub(const std::string &section, const user_conn &user, overflow_action action,
+                       std::shared_ptr<delivery> route, const replay_cursor &resume, replay_cursor &current);
     int handle_msg_unsub(const std::string &section, const user_conn &user);
-    int send_msg_to_client(const nlohmann::json &doc);
-    int broadcast_msg_to_subscriber(const nlohmann::json &doc);
+    int handle_msg_batch(session session, const conn_cache::handle &conn, const nlohmann::json &commands);
+    int send_msg_to_client(const message_ptr &msg);
+    // fds 随消息通过 SCM_RIGHTS 传递,只适用于面向连接的客户端
+    int send_msg_to_client(const nlohmann::json &doc, const std::vector<int> &fds = {});
+    int broadcast_msg_to_subscriber(const message_ptr &msg);
+    int find_client(session session, conn_cache::handle &conn);
+    nlohmann::json stats();
 
     int update_token(const std::string &token);
+    int update_format(const user_conn &user, wire_format format);
+    int open_channel(const user_conn &user, size_t capacity, std::shared_ptr<shm_channel> &channel);
 
 private:
-    int send_msg_to_client(user_conn conn, const std::string &msg);
-    int broadcast_msg_to_subscriber(const std::string &section, const std::string &msg);
+    int send_msg_to_client(const user_conn &conn, std::string_view msg, const std::vector<int> &fds = {});
+    int remove_subscriber(const std::vector<std::string_view> &peers);
+    void release_session(const user_conn &conn, session session);
+    void expire_sessions(stream_conn &stream, std::chrono::steady_clock::time_point now);
+    int complete_batch_item(session session, int code);
+    void expire_batch(session id);
+    int reply_batch(const batch_state &batch);
 
 private:
     std::shared_ptr<audience> audience_ = nullptr;
     bool running_;
     int socket_ = 0;
-    std::map<std::string, std::list<user_conn_counter>> sub_;
+    int stream_socket_ = 0;
+    // 面向连接的客户端尚未响应的请求
+    std::unordered_map<session, conn_cache::handle> streams_;
+    std::mutex stream_mutex_;
+    // 已建立的连接,只在 epoll 线程中访问
+    std::unordered_map<int, user_conn> connections_;
+    // 尚未全部响应的批量请求,以及其中每条命令所属的请求和序号
+    std::unordered_map<session, std::shared_ptr<batch_state>> batches_;
+    std::unordered_map<session, std::pair<std::shared_ptr<batch_state>, size_t>> batch_items_;
+    std::mutex batch_mutex_;
+    uint64_t connection_id_ = 0;
+    // 推送时只在取得订阅者列表时加锁,列表本身不可修改,订阅关系变化时重新生成
+    subscription_registry sub_;
     std::mutex sub_mutex_;
+    // 事件的编号和保留的事件,与订阅关系一起由 sub_mutex_ 保护
+    replay_ring replay_;
+    // 推送成功,对端接收队列已满,发送队列已满而丢弃,因处理过慢断开以及因对端关闭而取消订阅的次数
+    std::atomic<uint64_t> sent_ = 0;
+    std::atomic<uint64_t> blocked_ = 0;
+    std::atomic<uint64_t> dropped_ = 0;
+    std::atomic<uint64_t> disconnected_ = 0;
+    std::atomic<uint64_t> dead_ = 0;
+    // 有事件待发送的订阅者,由发送线程取走
+    std::vector<subscriber> ready_;
+    // 因处理过慢断开的订阅者,由发送线程取消订阅
+    std::vector<std::string> disconnecting_;
+    std::mutex flush_mutex_;
+    int flush_event_ = -1;
+    std::atomic<bool> flushing_ = true;
+    // 发送线程使用数据报 socket,退出后才能关闭
+    std::atomic<bool> flush_exited_ = false;
     std::atomic<session> id_ = SYSTEM_SESSION;
     token token_;
+    // 切换过编码格式的数据报客户端,未记录的客户端使用 Json
+    sharded_lru<std::string, wire_format, string_hash> formats_;
 
 private:
     int start_unix_domain_socket();
+    int start_stream_socket();
+    int start_flush();
+    void flush(std::vector<subscriber> &round, flush_state &state);
+    void overflow(const subscriber &target, const message_ptr &msg);
+    void enqueue(const subscriber &target, const message_ptr &msg, std::vector<subscriber> &scheduled);
+    void schedule(std::vector<subscriber> &scheduled);
+    void wake_flush();
+    void schedule_aggregate(const std::shared_ptr<aggregator> &aggregate);
+    void emit_aggregate(const std::weak_ptr<aggregator> &weak);
+    int accept_stream(int epoll);
+    void close_stream(int epoll, int fd);
+    message_ptr accept_request(char *buffer, size_t size, user_conn conn, std::string &spliced);
     session generate_user_session();
-    bool check_token(const nlohmann::json &data);
+    session generate_user_sessions(size_t count);
+    bool check_token(const nlohmann::json &token);
+    wire_format current_format(const user_conn &conn);
 };
 
 }; // namespace ipc
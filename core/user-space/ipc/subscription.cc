@@ -0,0 +1,336 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#include "ipc/subscription.h"
+#include <algorithm>
+#include <errno.h>
+
+namespace hackernel {
+
+namespace ipc {
+
+int parse_overflow_action(std::string_view name, overflow_action &action) {
+    if (name == "drop")
+        action = overflow_action::drop;
+    else if (name == "disconnect")
+        action = overflow_action::disconnect;
+    else if (name == "summary")
+        action = overflow_action::summary;
+    else
+        return -EINVAL;
+    return 0;
+}
+
+const char *overflow_action_name(overflow_action action) {
+    switch (action) {
+    case overflow_action::disconnect:
+        return "disconnect";
+    case overflow_action::summary:
+        return "summary";
+    default:
+        return "drop";
+    }
+}
+
+void aggregator::add(event_fields &fields) {
+    std::string group = "[";
+    for (const std::string &key : keys) {
+        std::string_view value;
+        if (group.size() > 1)
+            group.push_back(',');
+        group.append(fields.find(key, value) ? value : "null");
+    }
+    group.push_back(']');
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++total_;
+    auto it = groups_.find(group);
+    if (it != groups_.end())
+        ++it->second;
+    else if (groups_.size() < AGGREGATE_GROUPS_MAX)
+        groups_.emplace(std::move(group), 1);
+    else
+        ++other_;
+}
+
+nlohmann::json aggregator::take() {
+    std::unordered_map<std::string, uint64_t> groups;
+    nlohmann::json data;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        groups.swap(groups_);
+        data["total"] = total_;
+        data["other"] = other_;
+        total_ = other_ = 0;
+    }
+
+    data["type"] = "user::msg::aggregate";
+    data["section"] = topic;
+    data["interval"] = interval.count();
+    data["counts"] = nlohmann::json::array();
+    for (const auto &[group, count] : groups) {
+        nlohmann::json values = nlohmann::json::parse(group, nullptr, false);
+        nlohmann::json item;
+        for (size_t i = 0; i < keys.size() && values.is_array(); ++i)
+            item["key"][keys[i]] = values[i];
+        item["count"] = count;
+        data["counts"].push_back(std::move(item));
+    }
+    return data;
+}
+
+bool delivery::accept(event_fields &fields) {
+    if (filter && !filter->match(fields))
+        return false;
+    if (aggregate) {
+        aggregate->add(fields);
+        return false;
+    }
+    return sample <= 1 || seen.fetch_add(1, std::memory_order_relaxed) % sample == 0;
+}
+
+// 取出 begin 开始的一级主题,end 为分隔符的位置,没有后续层级时为 npos
+static std::string_view next_segment(std::string_view topic, size_t begin, size_t &end) {
+    end = topic.find(TOPIC_SEPARATOR, begin);
+    return topic.substr(begin, end == std::string_view::npos ? std::string_view::npos : end - begin);
+}
+
+int subscription_registry::check_topic(std::string_view topic) {
+    size_t begin = 0, end;
+    do {
+        std::string_view segment = next_segment(topic, begin, end);
+        if (segment.empty())
+            return -EINVAL;
+        if (segment == TOPIC_WILDCARD && end != std::string_view::npos)
+            return -EINVAL;
+        if (segment != TOPIC_WILDCARD && segment.find(TOPIC_WILDCARD) != std::string_view::npos)
+            return -EINVAL;
+        begin = end + TOPIC_SEPARATOR.size();
+    } while (end != std::string_view::npos);
+    return 0;
+}
+
+bool subscription_registry::match_topic(std::string_view topic, std::string_view type) {
+    if (!topic.ends_with(TOPIC_WILDCARD))
+        return topic == type;
+    topic.remove_suffix(TOPIC_WILDCARD.size());
+    return type.size() > topic.size() && type.starts_with(topic);
+}
+
+void subscription_registry::insert_topic(std::string_view topic, const std::string &peer) {
+    topic_node *node = &root_;
+    size_t begin = 0, end;
+    for (;;) {
+        std::string_view segment = next_segment(topic, begin, end);
+        if (segment == TOPIC_WILDCARD) {
+            if (node->wildcard.empty())
+                ++topic_count_;
+            node->wildcard.insert(peer);
+            return;
+        }
+
+        auto child = node->children.find(segment);
+        if (child == node->children.end())
+            child = node->children.emplace(segment, std::make_unique<topic_node>()).first;
+        node = child->second.get();
+
+        if (end == std::string_view::npos)
+            break;
+        begin = end + TOPIC_SEPARATOR.size();
+    }
+
+    if (node->exact.empty())
+        ++topic_count_;
+    node->exact.insert(peer);
+}
+
+void subscription_registry::erase_topic(std::string_view topic, const std::string &peer) {
+    std::vector<std::pair<topic_node *, std::string_view>> path;
+    topic_node *node = &root_;
+    size_t begin = 0, end;
+    for (;;) {
+        std::string_view segment = next_segment(topic, begin, end);
+        if (segment == TOPIC_WILDCARD) {
+            if (node->wildcard.erase(peer) && node->wildcard.empty())
+                --topic_count_;
+            break;
+        }
+
+        auto child = node->children.find(segment);
+        if (child == node->children.end())
+            return;
+        path.emplace_back(node, segment);
+        node = child->second.get();
+
+        if (end == std::string_view::npos) {
+            if (node->exact.erase(peer) && node->exact.empty())
+                --topic_count_;
+            break;
+        }
+        begin = end + TOPIC_SEPARATOR.size();
+    }
+
+    // 自下而上删除不再有订阅的节点
+    while (!path.empty()) {
+        auto [parent, segment] = path.back();
+        topic_node *current = parent->children.find(segment)->second.get();
+        if (!current->children.empty() || !current->exact.empty() || !current->wildcard.empty())
+            break;
+        parent->children.erase(parent->children.find(segment));
+        path.pop_back();
+    }
+}
+
+// 同一个客户端的队列满时的处理方式以最近一次订阅为准,同一主题的推送方式同样如此
+int subscription_registry::subscribe(const std::string &topic, std::string_view peer, const user_conn &conn,
+                                     overflow_action action, std::shared_ptr<delivery> route) {
+    if (check_topic(topic))
+        return -EINVAL;
+
+    auto it = peers_.find(peer);
+    if (it == peers_.end()) {
+        it = peers_.emplace(std::string(peer), peer_entry()).first;
+        it->second.target.conn = conn;
+    }
+    it->second.target.out->action = action;
+
+    topic_entry &entry = it->second.topics[topic];
+    if (++entry.count == 1)
+        insert_topic(topic, it->first);
+
+    if (entry.count == 1 || entry.route || route) {
+        entry.route = std::move(route);
+        resolved_.clear();
+    }
+    return 0;
+}
+
+int subscription_registry::unsubscribe(const std::string &topic, std::string_view peer) {
+    auto it = peers_.find(peer);
+    if (it == peers_.end())
+        return -EPERM;
+
+    auto counter = it->second.topics.find(topic);
+    if (counter == it->second.topics.end())
+        return -EPERM;
+    if (--counter->second.count > 0)
+        return 0;
+
+    erase_topic(topic, it->first);
+    it->second.topics.erase(counter);
+    if (it->second.topics.empty()) {
+        it->second.target.out->closed = true;
+        peers_.erase(it);
+    }
+    resolved_.clear();
+    return 0;
+}
+
+int subscription_registry::remove(std::string_view peer) {
+    auto it = peers_.find(peer);
+    if (it == peers_.end())
+        return -ESRCH;
+
+    for (const auto &[topic, entry] : it->second.topics)
+        erase_topic(topic, it->first);
+    it->second.target.out->closed = true;
+    peers_.erase(it);
+    resolved_.clear();
+    return 0;
+}
+
+int subscription_registry::update_format(std::string_view peer, wire_format format) {
+    auto it = peers_.find(peer);
+    if (it == peers_.end())
+        return -ESRCH;
+
+    it->second.target.conn.format = format;
+    resolved_.clear();
+    return 0;
+}
+
+std::shared_ptr<const subscription_list> subscription_registry::resolve(std::string_view type) {
+    auto cached = resolved_.find(type);
+    if (cached != resolved_.end())
+        return cached->second;
+
+    // 匹配到的客户端以及通过哪个主题匹配,用于查找该订阅的过滤条件
+    std::vector<std::pair<std::string_view, std::string>> matched;
+    const topic_node *node = &root_;
+    size_t begin = 0, end;
+    for (;;) {
+        // 通配符只匹配更深层级的消息类型
+        for (const std::string &peer : node->wildcard)
+            matched.emplace_back(peer, std::string(type.substr(0, begin)).append(TOPIC_WILDCARD));
+
+        auto child = node->children.find(next_segment(type, begin, end));
+        if (child == node->children.end())
+            break;
+        node = child->second.get();
+
+        if (end == std::string_view::npos) {
+            for (const std::string &peer : node->exact)
+                matched.emplace_back(peer, type);
+            break;
+        }
+        begin = end + TOPIC_SEPARATOR.size();
+    }
+
+    // 同时通过多个主题订阅了同一类型的客户端只推送一次.只有过滤条件时合并为一个条件,
+    // 任意一个订阅没有过滤条件时不过滤,有抽样或聚合时保留每个订阅的推送方式
+    std::sort(matched.begin(), matched.end());
+    auto conns = std::make_shared<subscription_list>();
+    for (size_t i = 0, next; i < matched.size(); i = next) {
+        const peer_entry &entry = peers_.find(matched[i].first)->second;
+        auto routes = std::make_shared<delivery_list>();
+        std::vector<std::shared_ptr<const event_filter>> filters;
+        bool unfiltered = false, stateful = false;
+        for (next = i; next < matched.size() && matched[next].first == matched[i].first; ++next) {
+            const auto &route = entry.topics.find(matched[next].second)->second.route;
+            routes->push_back(route);
+            if (route && (route->aggregate || route->sample > 1))
+                stateful = true;
+            else if (route && route->filter)
+                filters.push_back(route->filter);
+            else
+                unfiltered = true;
+        }
+
+        conns->push_back(entry.target);
+        if (stateful)
+            conns->back().routes = routes;
+        else if (!unfiltered)
+            conns->back().filter = event_filter::any_of(filters);
+    }
+
+    if (resolved_.size() >= TOPIC_RESOLVED_MAX)
+        resolved_.clear();
+    resolved_.emplace(std::string(type), conns);
+    return conns;
+}
+
+int subscription_registry::find(std::string_view peer, subscriber &target) const {
+    auto it = peers_.find(peer);
+    if (it == peers_.end())
+        return -ESRCH;
+    target = it->second.target;
+    return 0;
+}
+
+size_t subscription_registry::topic_count() const {
+    return topic_count_;
+}
+
+size_t subscription_registry::peer_count() const {
+    return peers_.size();
+}
+
+std::vector<subscriber> subscription_registry::subscribers() const {
+    std::vector<subscriber> result;
+    result.reserve(peers_.size());
+    for (const auto &[peer, entry] : peers_)
+        result.push_back(entry.target);
+    return result;
+}
+
+}; // namespace ipc
+
+}; // namespace hackernel
@@ -0,0 +1,171 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#ifndef IPC_SUBSCRIPTION_H
+#define IPC_SUBSCRIPTION_H
+
+#include "hackernel/broadcaster.h"
+#include "hackernel/ipc.h"
+#include "hackernel/queue.h"
+#include "ipc/filter.h"
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace hackernel {
+
+namespace ipc {
+
+// 订阅的主题以 "::" 分隔层级,最后一级可以是 "*",匹配该前缀下任意层级的消息类型,
+// 如 "kernel::file::*" 匹配 "kernel::file::report", "*" 匹配全部消息
+static const std::string_view TOPIC_SEPARATOR = "::";
+static const std::string_view TOPIC_WILDCARD = "*";
+// 缓存的消息类型数量上限,超出后清空重新解析
+static const size_t TOPIC_RESOLVED_MAX = 4096;
+// 每个订阅者最多积压的事件数量
+static const size_t SUBSCRIBER_QUEUE_CAPACITY = 4096;
+// 聚合订阅的字段数量,每个周期内不同取值组合的数量上限,超出的事件计入 other
+static const size_t AGGREGATE_KEYS_MAX = 8;
+static const size_t AGGREGATE_GROUPS_MAX = 4096;
+static const std::chrono::milliseconds AGGREGATE_INTERVAL_MIN(100);
+static const std::chrono::milliseconds AGGREGATE_INTERVAL_MAX(3600 * 1000);
+
+// 订阅者的发送队列已满时的处理方式
+enum class overflow_action {
+    // 丢弃新的事件
+    drop,
+    // 取消该订阅者的全部订阅,面向连接的客户端同时断开连接
+    disconnect,
+    // 丢弃新的事件,积压清空后推送一条按类型统计的丢弃数量
+    summary,
+};
+
+int parse_overflow_action(std::string_view name, overflow_action &action);
+const char *overflow_action_name(overflow_action action);
+
+// 订阅者的发送队列.推送事件的线程只写入队列,由发送线程以非阻塞的方式统一发送,
+// 处理缓慢的订阅者只会让自己的队列积压
+struct outbound {
+    mpsc_queue<message_ptr> queue{SUBSCRIBER_QUEUE_CAPACITY, overflow_policy::drop_newest};
+    std::atomic<overflow_action> action = overflow_action::drop;
+    // 已经交给发送线程,由发送线程在队列清空时清除
+    std::atomic<bool> scheduled = false;
+    // 已经取消订阅,队列中的事件不再发送
+    std::atomic<bool> closed = false;
+    // 上次没有发送成功的事件,只由发送线程访问
+    message_ptr head;
+    // summary 策略下丢弃的事件数量,按消息类型统计
+    std::mutex omitted_mutex;
+    std::map<std::string, uint64_t, std::less<>> omitted;
+
+    std::atomic<uint64_t> sent = 0;
+    std::atomic<uint64_t> dropped = 0;
+    std::atomic<uint64_t> blocked = 0;
+};
+
+// 按字段聚合的订阅.事件只在这里计数,由定时器每个周期取走一次汇总推送给订阅者
+struct aggregator {
+    std::string peer;
+    std::string topic;
+    std::vector<std::string> keys;
+    std::chrono::milliseconds interval;
+
+    // 各字段原始文本组成的 Json 数组作为分组的键
+    void add(event_fields &fields);
+    // 取走当前周期的计数,生成 user::msg::aggregate 事件的内容
+    nlohmann::json take();
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, uint64_t> groups_;
+    uint64_t total_ = 0;
+    uint64_t other_ = 0;
+};
+
+// 单个订阅的推送方式,依次经过过滤,抽样或聚合
+struct delivery {
+    std::shared_ptr<const event_filter> filter;
+    // 每 sample 个满足条件的事件推送一个
+    uint32_t sample = 1;
+    std::atomic<uint64_t> seen = 0;
+    // 不为空时不推送原始事件
+    std::shared_ptr<aggregator> aggregate;
+
+    // 返回是否需要推送原始事件
+    bool accept(event_fields &fields);
+};
+
+typedef std::vector<std::shared_ptr<delivery>> delivery_list;
+
+// 订阅者,同一个客户端的所有订阅共享一份发送队列
+struct subscriber {
+    user_conn conn;
+    std::shared_ptr<outbound> out = std::make_shared<outbound>();
+    // 解析消息类型时合并该客户端匹配到的各个订阅的过滤条件,为空时不过滤
+    std::shared_ptr<const event_filter> filter;
+    // 匹配到的订阅中有抽样或聚合时逐个判断,任意一个需要推送即推送,空指针表示直接推送
+    std::shared_ptr<const delivery_list> routes;
+};
+
+typedef std::vector<subscriber> subscription_list;
+
+// 按客户端索引的订阅表,订阅和取消订阅只需要两次哈希查找.
+// 通配符主题存放在按层级划分的前缀树中,每种消息类型解析出的订阅者列表会被缓存,
+// 订阅关系变化时清空缓存.不是线程安全的,由调用方加锁
+class subscription_registry {
+    struct topic_node {
+        std::unordered_map<std::string, std::unique_ptr<topic_node>, string_hash, std::equal_to<>> children;
+        // 精确订阅当前主题的客户端
+        std::unordered_set<std::string> exact;
+        // 订阅了当前主题下 "*" 的客户端
+        std::unordered_set<std::string> wildcard;
+    };
+
+    struct topic_entry {
+        // 订阅次数,减到 0 时取消订阅
+        int count = 0;
+        // 以最近一次订阅为准,为空时直接推送
+        std::shared_ptr<delivery> route;
+    };
+
+    struct peer_entry {
+        subscriber target;
+        std::unordered_map<std::string, topic_entry, string_hash, std::equal_to<>> topics;
+    };
+
+public:
+    int subscribe(const std::string &topic, std::string_view peer, const user_conn &conn,
+                  overflow_action action = overflow_action::drop, std::shared_ptr<delivery> route = nullptr);
+    int unsubscribe(const std::string &topic, std::string_view peer);
+    int remove(std::string_view peer);
+    int update_format(std::string_view peer, wire_format format);
+    std::shared_ptr<const subscription_list> resolve(std::string_view type);
+    int find(std::string_view peer, subscriber &target) const;
+    size_t topic_count() const;
+    size_t peer_count() const;
+    std::vector<subscriber> subscribers() const;
+    // 消息类型是否属于订阅的主题,与推送时的匹配规则相同
+    static bool match_topic(std::string_view topic, std::string_view type);
+
+private:
+    static int check_topic(std::string_view topic);
+    void insert_topic(std::string_view topic, const std::string &peer);
+    void erase_topic(std::string_view topic, const std::string &peer);
+
+private:
+    topic_node root_;
+    size_t topic_count_ = 0;
+    std::unordered_map<std::string, peer_entry, string_hash, std::equal_to<>> peers_;
+    std::unordered_map<std::string, std::shared_ptr<const subscription_list>, string_hash, std::equal_to<>> resolved_;
+};
+
+}; // namespace ipc
+
+}; // namespace hackernel
+
+#endif
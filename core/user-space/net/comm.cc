@@ -2,8 +2,8 @@
 #include "hackernel/broadcaster.h"
 #include "hackernel/ipc.h"
 #include "hackernel/net.h"
+#include "hackernel/report.h"
 #include "nlc/netlink.h"
-#include <arpa/inet.h>
 #include <netlink/genl/genl.h>
 #include <netlink/msg.h>
 #include <nlohmann/json.hpp>
@@ -85,7 +85,7 @@ int clear_net_policy(int32_t session) {
     return 0;
 }
 
-static int generate_net_protection_enable_msg(const int32_t &session, const int32_t &code, std::string &msg) {
+static int generate_net_protection_enable_msg(const int32_t &session, const int32_t &code, message_ptr &msg) {
     nlohmann::json doc;
     doc["type"] = "kernel::net::enable";
     doc["code"] = code;
@@ -93,7 +93,7 @@ static int generate_net_protection_enable_msg(const int32_t &session, const int3
     return 0;
 }
 
-static int generate_net_protection_disable_msg(const int32_t &session, const int32_t &code, std::string &msg) {
+static int generate_net_protection_disable_msg(const int32_t &session, const int32_t &code, message_ptr &msg) {
     nlohmann::json doc;
     doc["type"] = "kernel::net::disable";
     doc["code"] = code;
@@ -101,7 +101,7 @@ static int generate_net_protection_disable_msg(const int32_t &session, const int
     return 0;
 }
 
-static int generate_net_protection_insert_msg(const int32_t &session, const int32_t &code, std::string &msg) {
+static int generate_net_protection_insert_msg(const int32_t &session, const int32_t &code, message_ptr &msg) {
     nlohmann::json doc;
     doc["type"] = "kernel::net::insert";
     doc["code"] = code;
@@ -109,7 +109,7 @@ static int generate_net_protection_insert_msg(const int32_t &session, const int3
     return 0;
 }
 
-static int generate_net_protection_delete_msg(const int32_t &session, const int32_t &code, std::string &msg) {
+static int generate_net_protection_delete_msg(const int32_t &session, const int32_t &code, message_ptr &msg) {
     nlohmann::json doc;
     doc["type"] = "kernel::net::delete";
     doc["code"] = code;
@@ -117,7 +117,7 @@ static int generate_net_protection_delete_msg(const int32_t &session, const int3
     return 0;
 }
 
-static int generate_net_protection_clear_msg(const int32_t &session, const int32_t &code, std::string &msg) {
+static int generate_net_protection_clear_msg(const int32_t &session, const int32_t &code, message_ptr &msg) {
     nlohmann::json doc;
     doc["type"] = "kernel::net::clear";
     doc["code"] = code;
@@ -126,21 +126,8 @@ static int generate_net_protection_clear_msg(const int32_t &session, const int32
 }
 
 static int generate_net_protection_report_msg(uint8_t protocol, uint32_t saddr, uint32_t daddr, uint16_t sport,
-                                              uint16_t dport, uint32_t policy, std::string &msg) {
-    nlohmann::json doc;
-
-    struct in_addr ip_addr;
-
-    doc["type"] = "kernel::net::report";
-    doc["protocol"] = protocol;
-    ip_addr.s_addr = htonl(saddr);
-    doc["saddr"] = inet_ntoa(ip_addr);
-    ip_addr.s_addr = htonl(daddr);
-    doc["daddr"] = inet_ntoa(ip_addr);
-    doc["sport"] = sport;
-    doc["dport"] = dport;
-    doc["policy"] = policy;
-    msg = generate_system_broadcast_msg(doc);
+                                              uint16_t dport, uint32_t policy, message_ptr &msg) {
+    msg = make_net_report_msg(protocol, saddr, daddr, sport, dport, policy);
     return 0;
 }
 
@@ -185,7 +172,7 @@ int handle_genl_net_protection(struct nl_cache_ops *unused, struct genl_cmd *gen
     uint32_t saddr, daddr;
     uint16_t sport, dport;
     uint32_t policy;
-    std::string msg;
+    message_ptr msg;
 
     if (check_genl_net_protection_parm(genl_info))
         return -EINVAL;
@@ -241,7 +228,7 @@ int handle_genl_net_protection(struct nl_cache_ops *unused, struct genl_cmd *gen
         policy = nla_get_u32(genl_info->attrs[NET_A_ID]);
         generate_net_protection_report_msg(protocol, saddr, daddr, sport, dport, policy, msg);
         broadcaster::global().broadcast(msg);
-        DBG("kernel::net::report, msg=[%s]", msg.data());
+        DBG("kernel::net::report, msg=[%s]", msg->text().data());
         break;
     }
     return 0;
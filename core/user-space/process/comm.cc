@@ -2,6 +2,7 @@
 #include "hackernel/broadcaster.h"
 #include "hackernel/ipc.h"
 #include "hackernel/process.h"
+#include "hackernel/report.h"
 #include "nlc/netlink.h"
 #include "process/protector.h"
 #include <netlink/genl/genl.h>
@@ -51,17 +52,12 @@ int reply_process_permission(proc_perm_id id, proc_perm perm) {
 }
 
 static int generate_process_protection_report_msg(const std::string &workdir, const std::string &binary,
-                                                  const std::string &argv, std::string &msg) {
-    nlohmann::json doc;
-    doc["type"] = "kernel::proc::report";
-    doc["workdir"] = workdir;
-    doc["binary"] = binary;
-    doc["argv"] = argv;
-    msg = generate_system_broadcast_msg(doc);
+                                                  const std::string &argv, message_ptr &msg) {
+    msg = make_process_report_msg(workdir, binary, argv);
     return 0;
 }
 
-static int generate_process_protection_enable_msg(const int32_t &session, const int32_t &code, std::string &msg) {
+static int generate_process_protection_enable_msg(const int32_t &session, const int32_t &code, message_ptr &msg) {
     nlohmann::json doc;
     doc["type"] = "kernel::proc::enable";
     doc["code"] = code;
@@ -69,7 +65,7 @@ static int generate_process_protection_enable_msg(const int32_t &session, const
     return 0;
 }
 
-static int generate_process_protection_disable_msg(const int32_t &session, const int32_t &code, std::string &msg) {
+static int generate_process_protection_disable_msg(const int32_t &session, const int32_t &code, message_ptr &msg) {
     nlohmann::json doc;
     doc["type"] = "kernel::proc::disable";
     doc["code"] = code;
@@ -110,7 +106,7 @@ int handle_genl_process_protection(struct nl_cache_ops *unused, struct genl_cmd
 
     int error, id, code, session;
     char *workdir, *binary, *argv;
-    std::string msg;
+    message_ptr msg;
 
     if (check_genl_process_protection_parm(genl_info))
         return -EINVAL;
@@ -2,6 +2,7 @@
 #include "process/protector.h"
 #include "hackernel/broadcaster.h"
 #include "hackernel/ipc.h"
+#include "hackernel/schema.h"
 #include "hackernel/thread.h"
 #include "hackernel/timer.h"
 #include "hackernel/util.h"
@@ -61,10 +62,10 @@ int process_protector::report(const process_cmd_ctx &cmd) {
     doc["binary"] = cmd.binary;
     doc["argv"] = cmd.argv;
     doc["judge"] = judge_;
-    std::string msg = generate_system_broadcast_msg(doc);
+    message_ptr msg = generate_system_broadcast_msg(doc);
     broadcaster::global().broadcast(msg);
 
-    DBG("audit=[%s]", msg.data());
+    DBG("audit=[%s]", msg->text().data());
     return 0;
 }
 
@@ -73,48 +74,42 @@ process_protector &process_protector::global() {
     return instance;
 }
 
+static const schema<process_cmd_ctx> process_cmd_schema = schema<process_cmd_ctx>()
+                                                              .string("workdir", &process_cmd_ctx::workdir)
+                                                              .string("binary", &process_cmd_ctx::binary)
+                                                              .string("argv", &process_cmd_ctx::argv);
+
+static const schema<proc_perm> judge_schema =
+    schema<proc_perm>().integer("judge", [](proc_perm &judge) -> auto & { return judge; });
+
 // 根据广播中的消息更新配置,消息产生与配置更新解耦
-bool process_protector::handle_process_msg(const std::string &msg) {
-    nlohmann::json doc = json::parse(msg);
-    if (!doc["type"].is_string())
-        return false;
-    const std::string &type = doc["type"];
+bool process_protector::handle_process_msg(const message_ptr &msg) {
+    std::string_view type = msg->type();
 
     if (type == "user::proc::trusted::insert") {
+        nlohmann::json doc = msg->doc();
         nlohmann::json &data = doc["data"];
-        if (!data["workdir"].is_string())
-            return false;
-        if (!data["binary"].is_string())
-            return false;
-        if (!data["argv"].is_string())
-            return false;
         process_cmd_ctx cmd;
-        cmd.workdir = data["workdir"];
-        cmd.binary = data["binary"];
-        cmd.argv = data["argv"];
+        if (process_cmd_schema.decode(data, cmd))
+            return false;
         data["code"] = insert_trusted_cmd(cmd);
         ipc::ipc_server::global().send_msg_to_client(doc);
         return true;
     }
 
     if (type == "user::proc::trusted::delete") {
+        nlohmann::json doc = msg->doc();
         nlohmann::json &data = doc["data"];
-        if (!data["workdir"].is_string())
-            return false;
-        if (!data["binary"].is_string())
-            return false;
-        if (!data["argv"].is_string())
-            return false;
         process_cmd_ctx cmd;
-        cmd.workdir = data["workdir"];
-        cmd.binary = data["binary"];
-        cmd.argv = data["argv"];
+        if (process_cmd_schema.decode(data, cmd))
+            return false;
         data["code"] = delete_trusted_cmd(cmd);
         ipc::ipc_server::global().send_msg_to_client(doc);
         return true;
     }
 
     if (type == "user::proc::trusted::clear") {
+        nlohmann::json doc = msg->doc();
         nlohmann::json &data = doc["data"];
         data["code"] = clear_trusted_cmd();
         ipc::ipc_server::global().send_msg_to_client(doc);
@@ -122,10 +117,12 @@ bool process_protector::handle_process_msg(const std::string &msg) {
     }
 
     if (type == "user::proc::judge") {
+        nlohmann::json doc = msg->doc();
         nlohmann::json &data = doc["data"];
-        if (!data["judge"].is_number_integer())
+        proc_perm judge;
+        if (judge_schema.decode(data, judge))
             return false;
-        judge_ = data["judge"];
+        judge_ = judge;
         data["code"] = 0;
         ipc::ipc_server::global().send_msg_to_client(doc);
         return true;
@@ -145,14 +142,14 @@ bool process_protector::handle_process_msg(const std::string &msg) {
 }
 
 int process_protector::init() {
-    audience_ = std::make_shared<audience>();
+    audience_ = std::make_shared<audience>("process");
     if (!audience_) {
         ERR("make audience failed");
         return -ENOMEM;
     }
 
-    audience_->add_message_handler([&](const std::string &msg) { return handle_process_msg(msg); });
-    broadcaster::global().add_audience(audience_);
+    audience_->add_message_handler([&](const message_ptr &msg) { return handle_process_msg(msg); });
+    broadcaster::global().add_audience(audience_, {"user::proc::"});
     return 0;
 }
 
@@ -48,7 +48,7 @@ private:
     int delete_trusted_cmd(const process_cmd_ctx &cmd);
     int clear_trusted_cmd();
     bool is_trusted(const process_cmd_ctx &cmd);
-    bool handle_process_msg(const std::string &msg);
+    bool handle_process_msg(const message_ptr &msg);
 
 public:
     static process_protector &global();
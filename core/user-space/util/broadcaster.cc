@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: GPL-2.0-only */
 #include "hackernel/broadcaster.h"
 #include "hackernel/util.h"
+#include <algorithm>
 
 namespace hackernel {
 
@@ -9,69 +10,270 @@ int stop_all_audience() {
     return 0;
 }
 
+message::message(nlohmann::json doc) : doc_(std::move(doc)) {
+    std::call_once(doc_flag_, [] {});
+    if (doc_.is_object() && doc_.contains("type") && doc_["type"].is_string())
+        type_ = doc_["type"].get_ref<const std::string &>();
+    if (doc_.is_object() && doc_.contains("session") && doc_["session"].is_number_integer())
+        session_ = doc_["session"];
+
+    init_type();
+}
+
+message::message(int32_t session, std::string_view type, std::string_view payload) : session_(session) {
+    type_ = type;
+    payload_ = payload;
+    std::call_once(payload_flag_, [] {});
+    init_type();
+}
+
+void message::init_type() {
+    audit_ = type_.ends_with("::report");
+}
+
+message_ptr message::make(nlohmann::json doc) {
+    return std::make_shared<const message>(std::move(doc));
+}
+
+message_ptr message::make(int32_t session, std::string_view type, std::string_view payload) {
+    return std::make_shared<const message>(session, type, payload);
+}
+
+message_ptr message::parse(const std::string &text) {
+    return make(json::parse(text));
+}
+
+const nlohmann::json &message::doc() const {
+    std::call_once(doc_flag_, [&] {
+        doc_["session"] = session_;
+        doc_["type"] = std::string(type_);
+        doc_["data"] = nlohmann::json::parse(payload_.begin(), payload_.end());
+    });
+    return doc_;
+}
+
+int32_t message::session() const {
+    return session_;
+}
+
+std::string_view message::type() const {
+    return type_;
+}
+
+// 文本仅在需要时生成一次,例如打印日志
+const std::string &message::text() const {
+    std::call_once(text_flag_, [&] { text_ = json::dump(doc()); });
+    return text_;
+}
+
+std::string_view message::payload() const {
+    std::call_once(payload_flag_, [&] {
+        const nlohmann::json &doc = this->doc();
+        if (doc.is_object() && doc.contains("data"))
+            payload_ = json::dump(doc["data"]);
+    });
+    return payload_;
+}
+
+std::string_view message::payload(wire_format format) const {
+    if (format == wire_format::json)
+        return payload();
+
+    size_t index = (size_t)format - 1;
+    std::call_once(binary_flag_[index], [&] {
+        const nlohmann::json &doc = this->doc();
+        if (doc.is_object() && doc.contains("data"))
+            binary_[index] = json::encode(doc["data"], format);
+    });
+    return binary_[index];
+}
+
+bool message::is_audit() const {
+    return audit_;
+}
+
+audience::lanes::lanes(size_t capacity, overflow_policy policy)
+    : wakeup(std::make_shared<parking>()), control(capacity, policy, wakeup),
+      audit(capacity, policy, wakeup) {}
+
+audience::audience(const std::string &name, size_t capacity, overflow_policy policy, size_t workers) : name_(name) {
+    for (size_t i = 0; i < std::max<size_t>(workers, 1); ++i)
+        lanes_.push_back(std::make_unique<lanes>(capacity, policy));
+}
+
 void audience::set_broadcaster(std::weak_ptr<broadcaster> broadcaster) {
     this->bind_broadcaster_ = broadcaster;
 }
 
-void audience::save_message(std::string message) {
+void audience::set_message_key(message_key key) {
+    key_ = key;
+}
+
+size_t audience::worker_count() const {
+    return lanes_.size();
+}
+
+size_t audience::select_worker(const message_ptr &message) {
+    if (key_ && lanes_.size() > 1)
+        return key_(message) % lanes_.size();
+    return 0;
+}
+
+void audience::save_message(message_ptr message) {
+    if (!running_)
+        return;
+
+    lanes &current = *lanes_[select_worker(message)];
+    if (message->is_audit())
+        current.audit.push(std::move(message), true);
+    else
+        current.control.push(std::move(message), false);
+}
+
+void audience::save_messages(const std::vector<message_ptr> &messages) {
     if (!running_)
         return;
 
-    mutex_.lock();
-    message_queue_.push(message);
-    mutex_.unlock();
+    std::vector<bool> touched(lanes_.size());
+    for (const message_ptr &message : messages) {
+        size_t worker = select_worker(message);
+        lanes &current = *lanes_[worker];
+        if (message->is_audit())
+            current.audit.push(message, true, false);
+        else
+            current.control.push(message, false, false);
+        touched[worker] = true;
+    }
+
+    for (size_t i = 0; i < lanes_.size(); ++i) {
+        if (touched[i])
+            lanes_[i]->wakeup->notify();
+    }
+}
+
+void audience::offer_messages(const std::vector<message_ptr> &messages, std::vector<message_ptr> &rejected) {
+    if (!running_) {
+        rejected.insert(rejected.end(), messages.begin(), messages.end());
+        return;
+    }
+
+    std::vector<bool> touched(lanes_.size());
+    for (const message_ptr &message : messages) {
+        size_t worker = select_worker(message);
+        lanes &current = *lanes_[worker];
+        auto &queue = message->is_audit() ? current.audit : current.control;
+        if (queue.offer(message, false))
+            touched[worker] = true;
+        else
+            rejected.push_back(message);
+    }
 
-    cv_.notify_one();
+    for (size_t i = 0; i < lanes_.size(); ++i) {
+        if (touched[i])
+            lanes_[i]->wakeup->notify();
+    }
 }
 
-void audience::start_consuming_message() {
-    std::string message;
+void audience::start_consuming_message(size_t worker) {
+    std::vector<message_ptr> messages;
 
+    if (worker >= lanes_.size())
+        return;
+
+    lanes &current = *lanes_[worker];
     running_ = current_service_status();
     while (running_) {
-        if (wait_message(message))
+        if (wait_message(current, messages))
             continue;
 
-        for (const auto &handler : handlers_) {
-            if (handler(message)) {
+        for (const auto &message : messages) {
+            if (!running_)
                 break;
-            }
+            handle_message(message);
+        }
+        messages.clear();
+    }
+}
+
+void audience::handle_message(const message_ptr &message) {
+    auto it = typed_handlers_.find(message->type());
+    if (it != typed_handlers_.end() && it->second(message))
+        return;
+
+    for (const auto &handler : handlers_) {
+        if (handler(message)) {
+            break;
         }
     }
 }
 
 void audience::stop_consuming_message() {
-    mutex_.lock();
     running_ = false;
-    mutex_.unlock();
+    for (auto &current : lanes_) {
+        current->control.close();
+        current->audit.close();
+    }
+}
 
-    cv_.notify_one();
+void audience::add_message_handler(message_handler new_handler) {
+    handlers_.push_back(wrap_message_handler(new_handler));
 }
 
-void audience::add_message_handler(std::function<bool(const std::string &)> new_handler) {
-    handlers_.push_back([=](const std::string &msg) -> bool {
+void audience::add_message_handler(const std::string &type, message_handler new_handler) {
+    typed_handlers_[type] = wrap_message_handler(new_handler);
+}
+
+// 处理函数抛出异常时只丢弃这条消息,例如客户端请求的字段类型不符,不影响之后的消息.
+// 文档可能正是解析失败的部分,日志中只输出类型和 data 部分的原始文本
+message_handler audience::wrap_message_handler(message_handler handler) {
+    return [=](const message_ptr &msg) -> bool {
         try {
-            return new_handler(msg);
+            return handler(msg);
         } catch (std::exception &ex) {
-            ERR("handler error, request msg=[%s]", msg.data());
-            shutdown_service(HACKERNEL_BAD_AUDIENCE);
-            return false;
+            ERR("handler error, type=[%s] error=[%s] data=[%s]", std::string(msg->type()).data(), ex.what(),
+                std::string(msg->payload()).data());
+            return true;
         }
-    });
+    };
 }
 
-int audience::wait_message(std::string &message) {
-    using namespace std::chrono_literals;
+nlohmann::json audience::stats() const {
+    nlohmann::json doc;
+    doc["name"] = name_;
+    size_t size = 0, capacity = 0;
+    uint64_t received = 0, dropped = 0;
+    for (const auto &current : lanes_) {
+        for (const auto *queue : {&current->control, &current->audit}) {
+            size += queue->size();
+            capacity += queue->capacity();
+            received += queue->pushed();
+            dropped += queue->dropped();
+        }
+    }
+    doc["workers"] = lanes_.size();
+    doc["size"] = size;
+    doc["capacity"] = capacity;
+    doc["received"] = received;
+    doc["dropped"] = dropped;
+    return doc;
+}
 
-    std::unique_lock<std::mutex> lock(mutex_);
-    cv_.wait(lock, [&] { return !running_ || !message_queue_.empty(); });
+// 先取走全部控制消息,再取至多一批审计事件.控制消息最多等待一批审计事件的处理时间,
+// 审计事件每轮也能处理一批,不会因为控制消息持续到达而饿死.两条队列都为空时才进入休眠
+int audience::wait_message(lanes &current, std::vector<message_ptr> &messages) {
+    message_ptr message;
 
-    if (!running_)
-        return -EPERM;
+    while (running_) {
+        current.control.drain(messages);
+        for (size_t i = 0; i < AUDIENCE_AUDIT_BATCH && current.audit.pop(message); ++i)
+            messages.push_back(std::move(message));
 
-    message = message_queue_.front();
-    message_queue_.pop();
-    return 0;
+        if (!messages.empty())
+            return 0;
+
+        current.wakeup->wait([&] { return !current.control.empty() || !current.audit.empty(); });
+    }
+    return -EPERM;
 }
 
 broadcaster &broadcaster::global() {
@@ -79,28 +281,102 @@ broadcaster &broadcaster::global() {
     return instance;
 }
 
-void broadcaster::add_audience(std::shared_ptr<audience> audience) {
+bool broadcaster::subscriber::match(std::string_view type) const {
+    if (topics.empty())
+        return true;
+
+    for (const auto &topic : topics) {
+        if (type.starts_with(topic))
+            return true;
+    }
+    return false;
+}
+
+void broadcaster::add_audience(std::shared_ptr<audience> audience, message_topics topics) {
     audience->set_broadcaster(weak_from_this());
     const std::lock_guard<std::mutex> lock(mutex_);
-    audience_.push_back(audience);
+    auto audiences = std::make_shared<subscriber_list>(*audience_.load());
+    audiences->push_back({audience, std::move(topics)});
+    audience_.store(audiences);
 }
 
 void broadcaster::del_audience(std::shared_ptr<audience> audience) {
     const std::lock_guard<std::mutex> lock(mutex_);
-    audience_.remove(audience);
+    auto audiences = std::make_shared<subscriber_list>(*audience_.load());
+    std::erase_if(*audiences, [&](const subscriber &item) { return item.target == audience; });
+    audience_.store(audiences);
 }
 
-void broadcaster::broadcast(std::string message) {
-    const std::lock_guard<std::mutex> lock(mutex_);
-    for (auto &audience : audience_)
-        audience->save_message(message);
+void broadcaster::broadcast(message_ptr message) {
+    std::shared_ptr<const subscriber_list> audiences = audience_.load();
+    for (const auto &item : *audiences) {
+        if (item.match(message->type()))
+            item.target->save_message(message);
+    }
+}
+
+// 每个 audience 只取一次快照并整批写入
+void broadcaster::broadcast(const std::vector<message_ptr> &messages) {
+    thread_local std::vector<message_ptr> matched;
+    std::shared_ptr<const subscriber_list> audiences = audience_.load();
+    for (const auto &item : *audiences) {
+        matched.clear();
+        for (const message_ptr &message : messages) {
+            if (item.match(message->type()))
+                matched.push_back(message);
+        }
+        if (!matched.empty())
+            item.target->save_messages(matched);
+    }
+    matched.clear();
+}
+
+void broadcaster::offer(const std::vector<message_ptr> &messages, std::vector<message_ptr> &rejected) {
+    thread_local std::vector<message_ptr> matched;
+    std::shared_ptr<const subscriber_list> audiences = audience_.load();
+    for (const auto &item : *audiences) {
+        matched.clear();
+        for (const message_ptr &message : messages) {
+            if (item.match(message->type()))
+                matched.push_back(message);
+        }
+        if (!matched.empty())
+            item.target->offer_messages(matched, rejected);
+    }
+    matched.clear();
+}
+
+void broadcaster::broadcast(nlohmann::json doc) {
+    broadcast(message::make(std::move(doc)));
+}
+
+void broadcaster::broadcast(const std::string &message) {
+    message_ptr parsed;
+    try {
+        parsed = message::parse(message);
+    } catch (nlohmann::json::parse_error &ex) {
+        ERR("broadcast parse error, msg=[%s]", message.data());
+        return;
+    }
+    broadcast(parsed);
 }
 
 void broadcaster::notify_audience_stop() {
     const std::lock_guard<std::mutex> lock(mutex_);
-    for (auto &audience : audience_)
-        audience->stop_consuming_message();
-    audience_.clear();
+    std::shared_ptr<const subscriber_list> audiences = audience_.exchange(std::make_shared<const subscriber_list>());
+    for (const auto &item : *audiences)
+        item.target->stop_consuming_message();
+}
+
+nlohmann::json broadcaster::stats() {
+    nlohmann::json doc = nlohmann::json::array();
+    std::shared_ptr<const subscriber_list> audiences = audience_.load();
+    for (const auto &item : *audiences) {
+        nlohmann::json stats = item.target->stats();
+        stats["topics"] = item.topics;
+        doc.push_back(stats);
+    }
+    return doc;
 }
 
 }; // namespace hackernel
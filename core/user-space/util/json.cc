@@ -1,13 +1,14 @@
 /* SPDX-License-Identifier: GPL-2.0-only */
 #include "hackernel/json.h"
 #include "hackernel/lru.h"
+#include <cstring>
 
 namespace hackernel {
 
 namespace json {
 
 static const size_t json_cache_size = 1024;
-static lru<std::string, nlohmann::json> cache(json_cache_size);
+static sharded_lru<std::string, nlohmann::json> cache(json_cache_size);
 
 std::string dump(const nlohmann::json &doc) {
     std::string retval = doc.dump(-1, ' ', false, nlohmann::json::error_handler_t::ignore);
@@ -15,12 +16,12 @@ std::string dump(const nlohmann::json &doc) {
 }
 
 nlohmann::json parse(const std::string &msg) {
-    nlohmann::json doc;
-    if (!cache.get(msg, doc))
-        return doc;
+    sharded_lru<std::string, nlohmann::json>::handle cached;
+    if (!cache.get(msg, cached))
+        return *cached;
 
     // 与原本解析保持一直,允许产生异常
-    doc = nlohmann::json::parse(msg);
+    nlohmann::json doc = nlohmann::json::parse(msg);
 
     if (cache.put(msg, doc))
         ERR("insert json cache failed");
@@ -28,6 +29,296 @@ nlohmann::json parse(const std::string &msg) {
     return doc;
 }
 
+int parse_format(const std::string &name, wire_format &format) {
+    if (name == "json")
+        format = wire_format::json;
+    else if (name == "msgpack")
+        format = wire_format::msgpack;
+    else if (name == "cbor")
+        format = wire_format::cbor;
+    else
+        return -EINVAL;
+    return 0;
+}
+
+std::string encode(const nlohmann::json &doc, wire_format format) {
+    std::string retval;
+    switch (format) {
+    case wire_format::json:
+        retval = dump(doc);
+        break;
+    case wire_format::msgpack:
+        nlohmann::json::to_msgpack(doc, nlohmann::detail::output_adapter<char>(retval));
+        break;
+    case wire_format::cbor:
+        nlohmann::json::to_cbor(doc, nlohmann::detail::output_adapter<char>(retval));
+        break;
+    }
+    return retval;
+}
+
+// 构造文档时统计嵌套层数,超出时在进入下一层之前停止解析
+class bounded_dom_parser : public nlohmann::detail::json_sax_dom_parser<nlohmann::json> {
+public:
+    explicit bounded_dom_parser(nlohmann::json &doc) : json_sax_dom_parser(doc) {}
+
+    bool start_object(std::size_t len) {
+        return ++depth_ <= JSON_DEPTH_MAX && json_sax_dom_parser::start_object(len);
+    }
+
+    bool end_object() {
+        --depth_;
+        return json_sax_dom_parser::end_object();
+    }
+
+    bool start_array(std::size_t len) {
+        return ++depth_ <= JSON_DEPTH_MAX && json_sax_dom_parser::start_array(len);
+    }
+
+    bool end_array() {
+        --depth_;
+        return json_sax_dom_parser::end_array();
+    }
+
+private:
+    size_t depth_ = 0;
+};
+
+nlohmann::json decode(std::string_view msg, wire_format format) {
+    if (format == wire_format::json) {
+        if (check_depth(msg))
+            throw nlohmann::json::parse_error::create(101, 0, "nesting too deep", nullptr);
+        return parse(std::string(msg));
+    }
+
+    nlohmann::json doc;
+    bounded_dom_parser parser(doc);
+    auto input = format == wire_format::msgpack ? nlohmann::json::input_format_t::msgpack
+                                                : nlohmann::json::input_format_t::cbor;
+    if (!nlohmann::json::sax_parse(msg.begin(), msg.end(), &parser, input))
+        throw nlohmann::json::parse_error::create(101, 0, "nesting too deep", nullptr);
+    return doc;
+}
+
+static size_t skip_space(std::string_view msg, size_t pos) {
+    while (pos < msg.size() && (msg[pos] == ' ' || msg[pos] == '\t' || msg[pos] == '\r' || msg[pos] == '\n'))
+        ++pos;
+    return pos;
+}
+
+// pos 指向起始的引号,返回结束引号之后的位置
+static size_t skip_string(std::string_view msg, size_t pos) {
+    for (++pos; pos < msg.size(); ++pos) {
+        if (msg[pos] == '\\')
+            ++pos;
+        else if (msg[pos] == '"')
+            return pos + 1;
+    }
+    return msg.size();
+}
+
+static size_t skip_value(std::string_view msg, size_t pos) {
+    if (pos >= msg.size())
+        return pos;
+
+    if (msg[pos] == '"')
+        return skip_string(msg, pos);
+
+    if (msg[pos] != '{' && msg[pos] != '[') {
+        while (pos < msg.size() && !strchr(",}] \t\r\n", msg[pos]))
+            ++pos;
+        return pos;
+    }
+
+    int depth = 0;
+    while (pos < msg.size()) {
+        switch (msg[pos]) {
+        case '"':
+            pos = skip_string(msg, pos);
+            continue;
+        case '{':
+        case '[':
+            ++depth;
+            break;
+        case '}':
+        case ']':
+            if (--depth == 0)
+                return pos + 1;
+            break;
+        }
+        ++pos;
+    }
+    return pos;
+}
+
+int check_depth(std::string_view msg, size_t limit) {
+    size_t depth = 0;
+    size_t pos = 0;
+    while (pos < msg.size()) {
+        switch (msg[pos]) {
+        case '"':
+            pos = skip_string(msg, pos);
+            continue;
+        case '{':
+        case '[':
+            if (++depth > limit)
+                return -EINVAL;
+            break;
+        case '}':
+        case ']':
+            if (depth)
+                --depth;
+            break;
+        }
+        ++pos;
+    }
+    return 0;
+}
+
+int scan(std::string_view msg, const std::function<void(const std::string &key, std::string_view value)> &field) {
+    size_t pos = skip_space(msg, 0);
+    if (pos >= msg.size() || msg[pos] != '{')
+        return -EINVAL;
+
+    pos = skip_space(msg, pos + 1);
+    while (pos < msg.size() && msg[pos] == '"') {
+        size_t end = skip_string(msg, pos);
+        std::string_view raw = msg.substr(pos + 1, end - pos - 2);
+        // 键名中极少出现转义字符,出现时交给 nlohmann::json 处理
+        std::string key = raw.find('\\') == std::string_view::npos
+                              ? std::string(raw)
+                              : nlohmann::json::parse(msg.substr(pos, end - pos)).get<std::string>();
+
+        pos = skip_space(msg, skip_space(msg, end) + 1);
+        end = skip_value(msg, pos);
+        field(key, msg.substr(pos, end - pos));
+
+        pos = skip_space(msg, end);
+        if (pos < msg.size() && msg[pos] == ',')
+            pos = skip_space(msg, pos + 1);
+    }
+    return 0;
+}
+
+writer::writer(std::string &buffer) : buffer_(buffer) {}
+
+writer &writer::begin() {
+    buffer_.push_back('{');
+    first_ = true;
+    return *this;
+}
+
+writer &writer::end() {
+    buffer_.push_back('}');
+    return *this;
+}
+
+writer &writer::field(const char *key, std::string_view value) {
+    append_key(key);
+    buffer_.push_back('"');
+    append_escaped(value);
+    buffer_.push_back('"');
+    return *this;
+}
+
+// 地址为主机序
+writer &writer::field_ipv4(const char *key, uint32_t addr) {
+    char number[4];
+    append_key(key);
+    buffer_.push_back('"');
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        auto result = std::to_chars(number, number + sizeof(number), (addr >> shift) & 0xFF);
+        buffer_.append(number, result.ptr);
+        if (shift)
+            buffer_.push_back('.');
+    }
+    buffer_.push_back('"');
+    return *this;
+}
+
+void writer::append_key(const char *key) {
+    if (!first_)
+        buffer_.push_back(',');
+    first_ = false;
+    buffer_.push_back('"');
+    buffer_.append(key);
+    buffer_.append("\":");
+}
+
+// 与 dump 使用 error_handler_t::ignore 时的行为一致,跳过非法的 UTF-8 字节
+static size_t utf8_sequence_length(std::string_view value, size_t pos) {
+    const unsigned char *s = (const unsigned char *)value.data() + pos;
+    size_t remain = value.size() - pos;
+    auto cont = [&](size_t i, unsigned char low = 0x80, unsigned char high = 0xBF) {
+        return i < remain && s[i] >= low && s[i] <= high;
+    };
+
+    if (s[0] >= 0xC2 && s[0] <= 0xDF)
+        return cont(1) ? 2 : 0;
+    if (s[0] == 0xE0)
+        return cont(1, 0xA0) && cont(2) ? 3 : 0;
+    if ((s[0] >= 0xE1 && s[0] <= 0xEC) || s[0] == 0xEE || s[0] == 0xEF)
+        return cont(1) && cont(2) ? 3 : 0;
+    if (s[0] == 0xED)
+        return cont(1, 0x80, 0x9F) && cont(2) ? 3 : 0;
+    if (s[0] == 0xF0)
+        return cont(1, 0x90) && cont(2) && cont(3) ? 4 : 0;
+    if (s[0] >= 0xF1 && s[0] <= 0xF3)
+        return cont(1) && cont(2) && cont(3) ? 4 : 0;
+    if (s[0] == 0xF4)
+        return cont(1, 0x80, 0x8F) && cont(2) && cont(3) ? 4 : 0;
+    return 0;
+}
+
+void writer::append_escaped(std::string_view value) {
+    static const char *HEX = "0123456789abcdef";
+
+    size_t pos = 0;
+    while (pos < value.size()) {
+        unsigned char c = value[pos];
+        if (c >= 0x80) {
+            size_t length = utf8_sequence_length(value, pos);
+            if (length)
+                buffer_.append(value.data() + pos, length);
+            pos += length ? length : 1;
+            continue;
+        }
+
+        switch (c) {
+        case '"':
+            buffer_.append("\\\"");
+            break;
+        case '\\':
+            buffer_.append("\\\\");
+            break;
+        case '\b':
+            buffer_.append("\\b");
+            break;
+        case '\f':
+            buffer_.append("\\f");
+            break;
+        case '\n':
+            buffer_.append("\\n");
+            break;
+        case '\r':
+            buffer_.append("\\r");
+            break;
+        case '\t':
+            buffer_.append("\\t");
+            break;
+        default:
+            if (c < 0x20) {
+                buffer_.append("\\u00");
+                buffer_.push_back(HEX[c >> 4]);
+                buffer_.push_back(HEX[c & 0xF]);
+            } else {
+                buffer_.push_back(c);
+            }
+        }
+        ++pos;
+    }
+}
+
 }; // namespace json
 
 }; // namespace hackernel
\ No newline at end of file
@@ -104,7 +104,7 @@ void register_osinfo_timer() {
     doc["type"] = "osinfo::report";
     doc["cpu"] = info.get_cpu_usage();
     doc["mem"] = info.get_mem_usage();
-    std::string msg = generate_system_broadcast_msg(doc);
+    message_ptr msg = generate_system_broadcast_msg(doc);
     broadcaster::global().broadcast(msg);
 
     timer::timer::global().insert(event);
@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#include "hackernel/report.h"
+#include "hackernel/ipc.h"
+#include "hackernel/json.h"
+
+namespace hackernel {
+
+static std::string &report_buffer() {
+    thread_local std::string buffer;
+    buffer.clear();
+    return buffer;
+}
+
+// 字段按字典序写入,与 nlohmann::json 的输出保持一致
+message_ptr make_file_report_msg(std::string_view name, int32_t perm, unsigned long fsid, unsigned long ino) {
+    static const char *TYPE = "kernel::file::report";
+
+    std::string &buffer = report_buffer();
+    json::writer(buffer)
+        .begin()
+        .field("fsid", fsid)
+        .field("ino", ino)
+        .field("name", name)
+        .field("perm", perm)
+        .field("type", TYPE)
+        .end();
+    return message::make(SYSTEM_SESSION, TYPE, buffer);
+}
+
+message_ptr make_net_report_msg(uint8_t protocol, uint32_t saddr, uint32_t daddr, uint16_t sport, uint16_t dport,
+                                uint32_t policy) {
+    static const char *TYPE = "kernel::net::report";
+
+    std::string &buffer = report_buffer();
+    json::writer(buffer)
+        .begin()
+        .field_ipv4("daddr", daddr)
+        .field("dport", dport)
+        .field("policy", policy)
+        .field("protocol", protocol)
+        .field_ipv4("saddr", saddr)
+        .field("sport", sport)
+        .field("type", TYPE)
+        .end();
+    return message::make(SYSTEM_SESSION, TYPE, buffer);
+}
+
+message_ptr make_process_report_msg(std::string_view workdir, std::string_view binary, std::string_view argv) {
+    static const char *TYPE = "kernel::proc::report";
+
+    std::string &buffer = report_buffer();
+    json::writer(buffer)
+        .begin()
+        .field("argv", argv)
+        .field("binary", binary)
+        .field("type", TYPE)
+        .field("workdir", workdir)
+        .end();
+    return message::make(SYSTEM_SESSION, TYPE, buffer);
+}
+
+}; // namespace hackernel